@@ -0,0 +1,308 @@
+/*
+ * Accumulators for summing floats with differing accuracy/cost trade-offs,
+ * and an adaptive reduction which only pays for accuracy when the data
+ * needs it.
+ *
+ * License: Apache License v2.0 with LLVM Exceptions.
+ * See https://llvm.org/LICENSE.txt for license information.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+#ifndef REDUCTION_ACCURATE_SUMS_H
+#define REDUCTION_ACCURATE_SUMS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <omp.h>
+
+// All of the accumulators have the same interface, so that they can be
+// plugged into the same reduction code.
+//   add(v)      accumulate one value
+//   operator+=  combine another (per-thread) accumulator into this one
+//   value()     the result, as a double
+
+// The obvious thing; T is float or double.
+template<typename T> class plainAccumulator {
+  T total;
+ public:
+  plainAccumulator() : total(0) {}
+
+  void add(float v) { total += v; }
+  plainAccumulator & operator+=(plainAccumulator const & other) {
+    total += other.total;
+    return *this;
+  }
+  double value() const { return total; }
+};
+
+// Neumaier's variant of Kahan summation in double. Unlike plain Kahan it
+// copes with an addend which is larger than the running total (as happens
+// in initArray's final -1.0).
+class compensatedAccumulator {
+  double total;
+  double correction;
+ public:
+  compensatedAccumulator() : total(0.0), correction(0.0) {}
+
+  void add(double v) {
+    double t = total + v;
+    if (std::abs(total) >= std::abs(v)) {
+      correction += (total - t) + v;
+    } else {
+      correction += (v - t) + total;
+    }
+    total = t;
+  }
+  compensatedAccumulator & operator+=(compensatedAccumulator const & other) {
+    add(other.total);
+    correction += other.correction;
+    return *this;
+  }
+  double value() const { return total + correction; }
+};
+
+// An exact accumulator for floats (a "superaccumulator").
+// Every finite float is an integer multiple of 2^-149 smaller than 2^128, so
+// we can hold the sum as a fixed point number with 277 bits, plus some
+// headroom for carries. We keep it as 32 bit digits in int64_t slots so that
+// we only need to propagate carries occasionally.
+// Since integer addition is associative, the result does not depend on the
+// order of accumulation, so this is also bitwise reproducible.
+// Infinities and NaNs are not handled.
+class exactAccumulator {
+  enum {
+    digitBits = 32,
+    numDigits = 10,      // 320 bits
+    lsbExponent = -149,  // Weight of bit 0
+  };
+  // Each add changes a digit by less than 2^32, so we can do 2^31 adds
+  // before we must normalise; be conservative.
+  static constexpr uint32_t normaliseInterval = 1u << 30;
+
+  int64_t digits[numDigits];
+  uint32_t pending;
+
+  // Propagate carries so that all but the top digit lie in [0, 2^32).
+  void normalise() {
+    for (int i=0; i<numDigits-1; i++) {
+      int64_t carry = digits[i] >> digitBits; // Arithmetic shift, so floors
+      digits[i] &= 0xffffffff;
+      digits[i+1] += carry;
+    }
+    pending = 0;
+  }
+
+ public:
+  exactAccumulator() : pending(0) {
+    memset(&digits[0], 0, sizeof(digits));
+  }
+
+  void add(float v) {
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    uint32_t biasedExponent = (bits >> 23) & 0xff;
+    int64_t mantissa = bits & 0x7fffff;
+    // Denormals have the same weight as the smallest normal, but no
+    // implicit bit.
+    int position = 0;
+    if (biasedExponent != 0) {
+      mantissa |= 0x800000;
+      position = biasedExponent - 1;
+    }
+    if (bits >> 31) {
+      mantissa = -mantissa;
+    }
+    // Multiply rather than shift, since mantissa may be negative.
+    int64_t shifted = mantissa * (int64_t(1) << (position % digitBits));
+    int digit = position / digitBits;
+    digits[digit] += shifted & 0xffffffff;
+    digits[digit+1] += shifted >> digitBits;
+    if (++pending == normaliseInterval) {
+      normalise();
+    }
+  }
+  exactAccumulator & operator+=(exactAccumulator const & other) {
+    if (pending + other.pending + 1 >= normaliseInterval) {
+      normalise();
+    }
+    for (int i=0; i<numDigits; i++) {
+      digits[i] += other.digits[i];
+    }
+    pending += other.pending + 1;
+    return *this;
+  }
+  bool operator==(exactAccumulator const & other) const {
+    exactAccumulator a = *this, b = other;
+    a.normalise();
+    b.normalise();
+    return memcmp(&a.digits[0], &b.digits[0], sizeof(digits)) == 0;
+  }
+  // The sum is exact; this is its value rounded (very nearly correctly) to
+  // double.
+  double value() const {
+    exactAccumulator magnitude = *this;
+    magnitude.normalise();
+    bool negative = magnitude.digits[numDigits-1] < 0;
+    if (negative) {
+      for (int i=0; i<numDigits; i++) {
+        magnitude.digits[i] = -magnitude.digits[i];
+      }
+      magnitude.normalise();
+    }
+    // Now all the digits are non-negative, so there is no cancellation.
+    double res = 0.0;
+    for (int i=0; i<numDigits; i++) {
+      res += std::ldexp(double(magnitude.digits[i]), lsbExponent + i*digitBits);
+    }
+    return negative ? -res : res;
+  }
+};
+
+// Reduce with any of the accumulators. The per-thread accumulators are
+// combined in a critical section, as in omp_scan.
+template<class Accumulator>
+static Accumulator accumulate(int n, float const * a) {
+  Accumulator total;
+
+  #pragma omp parallel
+  {
+    Accumulator mine;
+    #pragma omp for nowait
+    for (int i=0; i<n; i++)
+      mine.add(a[i]);
+
+    #pragma omp critical (accumulateCombine)
+    total += mine;
+  }
+  return total;
+}
+
+template<class Accumulator> static double accumulateTot(int n, float const * a) {
+  return accumulate<Accumulator>(n, a).value();
+}
+
+// Adaptive precision.
+// We do the cheap sum (float or double accumulator), and in the same pass
+// accumulate Higham's running error bound: each addition s = s + a[i]
+// commits an error of at most u*|s|, so sum(|s_k|)*u bounds the total error
+// (to first order). That's far tighter than the a-priori (n-1)*u*sum(|a|).
+// Only if the bound shows that we can't meet the requested relative
+// tolerance do we re-run with the compensated sum, and then, if even that
+// may not suffice (e.g. when the result is very close to zero), exactly.
+enum sumLevel {
+  cheapSum,
+  compensatedSum,
+  exactSum,
+  numSumLevels
+};
+
+inline char const * sumLevelName(sumLevel l) {
+  static char const * names[] = {"cheap", "compensated", "exact"};
+  return names[l];
+}
+
+struct adaptiveResult {
+  double value;
+  double errorBound; // Absolute bound on the error in value
+  sumLevel level;
+};
+
+template<typename T>
+static adaptiveResult adaptiveTot(int n, float const * a, double tolerance) {
+  constexpr double u = std::numeric_limits<T>::epsilon() / 2;
+  T total = 0;
+  double running = 0.0; // Sum of |partial sum|
+  double absTotal = 0.0;
+
+  #pragma omp parallel
+  {
+    T mine = 0;
+    double myRunning = 0.0;
+    double myAbs = 0.0;
+    #pragma omp for nowait
+    for (int i=0; i<n; i++) {
+      mine += a[i];
+      myRunning += std::abs(mine);
+      myAbs += std::abs(a[i]);
+    }
+    // Combine explicitly (rather than using a reduction clause), so that the
+    // additions made while combining are included in the bound too.
+    #pragma omp critical (adaptiveCombine)
+    {
+      total += mine;
+      running += myRunning + std::abs(total);
+      absTotal += myAbs;
+    }
+  }
+
+  adaptiveResult res = {total, u*running, cheapSum};
+  if (res.errorBound <= tolerance * std::abs(res.value)) {
+    return res;
+  }
+
+  // Neumaier's sum computes the same result as Ogita, Rump and Oishi's Sum2
+  // (each correction is the exact error of its addition), so their bound
+  // ("Accurate Sum and Dot Product", SISC 26(6), 2005, Prop. 4.5) applies:
+  //     |res - s| <= u|s| + gamma(m-1)^2 sum(|a|)
+  // where s is the exact sum, m the number of additions, and
+  // gamma(k) = k*u / (1 - k*u). Here m is n plus one per thread for the
+  // combining (the order of the additions doesn't matter to the bound), and
+  // u is for double, since the floats are exact in it. We only know res, so
+  // using |s| <= |res| + |res - s| gives
+  //     |res - s| <= (u|res| + gamma(m-1)^2 sum(|a|)) / (1 - u)
+  // absTotal was itself summed in double, so it may be low by up to a
+  // factor of (1 - gamma(m-1)).
+  constexpr double ud = std::numeric_limits<double>::epsilon() / 2;
+  double additions = double(n) + omp_get_max_threads();
+  double gamma = (additions - 1) * ud / (1 - (additions - 1) * ud);
+  res.value = accumulateTot<compensatedAccumulator>(n, a);
+  res.errorBound = (ud*std::abs(res.value) +
+                    gamma*gamma*absTotal / (1 - gamma)) / (1 - ud);
+  res.level = compensatedSum;
+  if (res.errorBound <= tolerance * std::abs(res.value)) {
+    return res;
+  }
+
+  res.value = accumulateTot<exactAccumulator>(n, a);
+  res.errorBound = ud*std::abs(res.value); // Just the final rounding
+  res.level = exactSum;
+  return res;
+}
+
+// A parallel approximation to orderedReduction.
+// orderedReduction always adds the two smallest values, which is accurate,
+// but serial (and O(n log n)). Instead each thread bins its values by float
+// exponent into a double bucket per exponent. All the floats in one bucket
+// are multiples of the same power of two and less than 2^24 times it, so
+// a double holds their sum exactly until a bucket has seen 2^29 values;
+// in practice the buckets are (very nearly) exact. We then merge the
+// threads' buckets and add them up in order of increasing magnitude.
+inline double bucketedTot(int n, float const * a) {
+  enum { numBuckets = 256 };
+  double buckets[numBuckets] = {};
+
+  #pragma omp parallel
+  {
+    double mine[numBuckets] = {};
+    #pragma omp for nowait
+    for (int i=0; i<n; i++) {
+      uint32_t bits;
+      memcpy(&bits, &a[i], sizeof(bits));
+      mine[(bits >> 23) & 0xff] += a[i];
+    }
+    #pragma omp critical (bucketCombine)
+    for (int b=0; b<numBuckets; b++)
+      buckets[b] += mine[b];
+  }
+
+  std::sort(&buckets[0], &buckets[numBuckets], [](double x, double y) {
+    return std::abs(x) < std::abs(y);
+  });
+  double total = 0.0;
+  for (int b=0; b<numBuckets; b++)
+    total += buckets[b];
+  return total;
+}
+#endif
@@ -0,0 +1,103 @@
+/*
+ * Show how often the adaptive reduction has to escalate beyond the cheap
+ * sum, for each of our input distributions and a range of tolerances, and
+ * what that costs compared with always doing the accurate thing.
+ *
+ * License: Apache License v2.0 with LLVM Exceptions.
+ * See https://llvm.org/LICENSE.txt for license information.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <omp.h>
+
+#include "accurateSums.h"
+#include "distributions.h"
+
+// Run the adaptive sum over a number of independent trials of one
+// distribution, and report the outcome.
+template<typename T>
+static void runTrials(char const * accName, distribution_t const & dist,
+                      int n, float * data, double tolerance, int trials) {
+  int levels[numSumLevels] = {0, 0, 0};
+  double maxRelError = 0.0;
+  double adaptiveTime = 0.0, exactTime = 0.0, compensatedTime = 0.0;
+  int violations = 0;
+  int missed = 0;
+  double const ulpHalf = std::numeric_limits<double>::epsilon() / 2;
+
+  for (int t=0; t<trials; t++) {
+    dist.init(n, data, t);
+
+    double start = omp_get_wtime();
+    adaptiveResult res = adaptiveTot<T>(n, data, tolerance);
+    adaptiveTime += omp_get_wtime() - start;
+
+    start = omp_get_wtime();
+    accumulateTot<compensatedAccumulator>(n, data);
+    compensatedTime += omp_get_wtime() - start;
+
+    start = omp_get_wtime();
+    double exact = accumulateTot<exactAccumulator>(n, data);
+    exactTime += omp_get_wtime() - start;
+
+    levels[res.level]++;
+    double error = std::abs(res.value - exact);
+    double relError = exact != 0.0 ? error / std::abs(exact) : error;
+    maxRelError = std::max(maxRelError, relError);
+    // Check that the bound we claimed really holds. exact has itself been
+    // rounded to double, so allow for that.
+    if (error > res.errorBound + ulpHalf * std::abs(exact)) {
+      violations++;
+    }
+    // And that we met the tolerance.
+    if (error > tolerance * std::abs(exact)) {
+      missed++;
+    }
+  }
+  printf("%-15s %-6s %8.0e %6.1f%% %6.1f%% %6.1f%%  %9.2e %8.2f %8.2f%s%s\n",
+         dist.name, accName, tolerance,
+         100.0*levels[cheapSum]/trials, 100.0*levels[compensatedSum]/trials,
+         100.0*levels[exactSum]/trials, maxRelError,
+         adaptiveTime/compensatedTime, adaptiveTime/exactTime,
+         violations ? " BOUND VIOLATED" : "",
+         missed ? " TOLERANCE MISSED" : "");
+}
+
+int main(int argc, char ** argv) {
+  int arraySize = argc > 1 ? atoi(argv[1]) : 100002;
+  int trials = argc > 2 ? atoi(argv[2]) : 20;
+  // The compensated sum's error bound grows as n^2, so check an
+  // ill-conditioned input at a large n too.
+  int largeSize = argc > 3 ? atoi(argv[3]) : 1 << 24;
+  float * data = new float[std::max(arraySize, largeSize)];
+  static double const tolerances[] = {1.e-3, 1.e-6, 1.e-9, 1.e-12};
+
+  printf("omp_get_max_threads() %d, %d elements, %d trials\n",
+         omp_get_max_threads(), arraySize, trials);
+  printf("Percentage of trials completed at each level, worst relative error,\n"
+         "and time relative to always using compensated or exact summation\n");
+  printf("%-15s %-6s %8s %7s %7s %7s  %9s %8s %8s\n", "Distribution", "Acc",
+         "Tol", "Cheap", "Comp", "Exact", "MaxRelErr", "vsComp", "vsExact");
+  for (auto const & dist : distributions) {
+    for (double tolerance : tolerances) {
+      runTrials<float>("float", dist, arraySize, data, tolerance, trials);
+      runTrials<double>("double", dist, arraySize, data, tolerance, trials);
+    }
+  }
+
+  distribution_t const & illConditioned = *findDistribution("illConditioned");
+  int largeTrials = std::max(1, trials / 5);
+  printf("\n%d elements, %d trials\n", largeSize, largeTrials);
+  for (double tolerance : tolerances) {
+    runTrials<float>("float", illConditioned, largeSize, data, tolerance,
+                     largeTrials);
+    runTrials<double>("double", illConditioned, largeSize, data, tolerance,
+                      largeTrials);
+  }
+  delete [] data;
+  return 0;
+}
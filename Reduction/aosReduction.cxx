@@ -0,0 +1,227 @@
+/*
+ * Reducing fields of an array of structs.
+ * A parTot style loop over one float field of a 32 byte record uses 4 of
+ * every 32 bytes we pull through the cache. We can
+ *  - reduce one field with a strided loop (which the compiler vectorises
+ *    with gathers, or scalar loads and inserts),
+ *  - reduce several fields in the same pass, so at least we use more of
+ *    each line,
+ *  - treat each record as a vector of float lanes and sum whole records,
+ *    which needs only contiguous loads; the "transpose" to fields happens
+ *    once, at the end, when we pick out the lanes we want,
+ *  - or convert to a struct of arrays once and then use plain parTot.
+ * The kernels are templated on the record type and the byte offsets of the
+ * fields, so all the addressing is compile-time constant.
+ *
+ * License: Apache License v2.0 with LLVM Exceptions.
+ * See https://llvm.org/LICENSE.txt for license information.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <omp.h>
+
+#include "reductions.h"
+
+// Read the float at a given byte offset in a record.
+template<typename R, size_t Offset> inline float fieldAt(R const & r) {
+  static_assert(Offset + sizeof(float) <= sizeof(R), "Field outside record");
+  float v;
+  memcpy(&v, reinterpret_cast<char const *>(&r) + Offset, sizeof(v));
+  return v;
+}
+
+// One field, strided.
+template<typename R, size_t Offset> static float fieldTot(int n, R const * r) {
+  float total = 0.0;
+
+  #pragma omp parallel for simd reduction(+:total)
+  for (int i=0; i<n; i++)
+    total += fieldAt<R, Offset>(r[i]);
+
+  return total;
+}
+
+// Several fields in one pass.
+template<typename R, size_t... Offsets>
+static std::array<float, sizeof...(Offsets)> fieldsTot(int n, R const * r) {
+  enum { numFields = sizeof...(Offsets) };
+  float totals[numFields] = {};
+
+  #pragma omp parallel for simd reduction(+:totals[:numFields])
+  for (int i=0; i<n; i++) {
+    int f = 0;
+    ((totals[f++] += fieldAt<R, Offsets>(r[i])), ...);
+  }
+
+  std::array<float, numFields> res;
+  std::copy(&totals[0], &totals[numFields], res.begin());
+  return res;
+}
+
+// Whole records as vectors of float lanes. Lanes which aren't float fields
+// accumulate rubbish, but we never look at them. (We copy the bits rather
+// than reading non-float fields as floats.)
+template<typename R, size_t... Offsets>
+static std::array<float, sizeof...(Offsets)> recordLanesTot(int n,
+                                                            R const * r) {
+  static_assert(sizeof(R) % sizeof(float) == 0,
+                "Records must be a whole number of floats");
+  static_assert(((Offsets % sizeof(float) == 0) && ...),
+                "Fields must be float aligned");
+  // Several independent accumulators, so that we aren't limited by the
+  // latency of the add.
+  enum { numLanes = sizeof(R) / sizeof(float), unroll = 4 };
+  float lanes[numLanes] = {};
+
+  #pragma omp parallel
+  {
+    float mine[unroll][numLanes] = {};
+    #pragma omp for nowait
+    for (int i=0; i<n/unroll; i++) {
+      char const * block = reinterpret_cast<char const *>(&r[i*unroll]);
+      for (int u=0; u<unroll; u++) {
+        for (int l=0; l<numLanes; l++) {
+          float v;
+          memcpy(&v, block + (u*numLanes + l)*sizeof(float), sizeof(v));
+          mine[u][l] += v;
+        }
+      }
+    }
+    #pragma omp critical (recordLanesTot)
+    for (int u=0; u<unroll; u++)
+      for (int l=0; l<numLanes; l++)
+        lanes[l] += mine[u][l];
+  }
+  // The leftovers.
+  for (int i=n - n%unroll; i<n; i++) {
+    char const * record = reinterpret_cast<char const *>(&r[i]);
+    for (int l=0; l<numLanes; l++) {
+      float v;
+      memcpy(&v, record + l*sizeof(float), sizeof(v));
+      lanes[l] += v;
+    }
+  }
+
+  return {lanes[Offsets / sizeof(float)]...};
+}
+
+// One-off conversion to a struct of arrays.
+template<typename R, size_t... Offsets>
+static void toSoA(int n, R const * r,
+                  std::array<float *, sizeof...(Offsets)> soa) {
+  #pragma omp parallel for
+  for (int i=0; i<n; i++) {
+    int f = 0;
+    ((soa[f++][i] = fieldAt<R, Offsets>(r[i])), ...);
+  }
+}
+
+// Our example record; 32 bytes, with the fields we want to reduce
+// interleaved with others.
+struct particle {
+  float x, y, z;
+  float mass;
+  int32_t id;
+  float vx, vy, vz;
+};
+
+#define PARTICLE_FIELDS offsetof(particle, x), offsetof(particle, y), \
+                        offsetof(particle, z), offsetof(particle, mass)
+enum { numFields = 4 };
+
+enum { repeats = 10 };
+
+template<typename Op> static double bestTime(Op op) {
+  double best = 1.e30;
+  for (int r=0; r<repeats; r++) {
+    double start = omp_get_wtime();
+    op();
+    best = std::min(best, omp_get_wtime() - start);
+  }
+  return best;
+}
+
+static bool close(std::array<float, numFields> const & a,
+                  std::array<float, numFields> const & b) {
+  for (int f=0; f<numFields; f++) {
+    if (std::abs(a[f] - b[f]) > 1.e-3 * std::abs(b[f]))
+      return false;
+  }
+  return true;
+}
+
+int main(int argc, char ** argv) {
+  int n = argc > 1 ? atoi(argv[1]) : (1 << 22);
+  particle * particles = new particle[n];
+  std::array<float *, numFields> soa;
+  for (auto & field : soa) {
+    field = new float[n];
+    std::fill(field, field + n, 0.0f);
+  }
+
+  std::mt19937 gen(1);
+  std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+  for (int i=0; i<n; i++) {
+    particles[i] = {dist(gen), dist(gen), dist(gen), dist(gen), i,
+                    dist(gen), dist(gen), dist(gen)};
+  }
+
+  printf("%d %zu byte records, omp_get_max_threads() %d\n", n,
+         sizeof(particle), omp_get_max_threads());
+  printf("Reducing %d float fields\n", numFields);
+  printf("%-22s %10s %10s\n", "Method", "ms", "ns/record");
+
+  auto report = [n](char const * name, double time) {
+    printf("%-22s %10.3f %10.3f\n", name, time * 1.e3, time / n * 1.e9);
+  };
+
+  std::array<float, numFields> reference;
+  report("one field (x)", bestTime([&]() {
+    return fieldTot<particle, offsetof(particle, x)>(n, particles);
+  }));
+  report("each field, strided", bestTime([&]() {
+    reference = {fieldTot<particle, offsetof(particle, x)>(n, particles),
+                 fieldTot<particle, offsetof(particle, y)>(n, particles),
+                 fieldTot<particle, offsetof(particle, z)>(n, particles),
+                 fieldTot<particle, offsetof(particle, mass)>(n, particles)};
+  }));
+
+  std::array<float, numFields> res;
+  report("all fields, one pass", bestTime([&]() {
+    res = fieldsTot<particle, PARTICLE_FIELDS>(n, particles);
+  }));
+  if (!close(res, reference))
+    printf("*** one pass result differs\n");
+
+  report("record lanes", bestTime([&]() {
+    res = recordLanesTot<particle, PARTICLE_FIELDS>(n, particles);
+  }));
+  if (!close(res, reference))
+    printf("*** record lanes result differs\n");
+
+  double convertTime = bestTime([&]() {
+    toSoA<particle, PARTICLE_FIELDS>(n, particles, soa);
+  });
+  report("SoA conversion", convertTime);
+  double soaTime = bestTime([&]() {
+    for (int f=0; f<numFields; f++)
+      res[f] = parTot(n, soa[f]);
+  });
+  report("SoA parTot, each field", soaTime);
+  report("SoA convert + reduce", convertTime + soaTime);
+  if (!close(res, reference))
+    printf("*** SoA result differs\n");
+
+  for (auto field : soa)
+    delete [] field;
+  delete [] particles;
+  return 0;
+}
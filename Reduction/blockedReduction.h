@@ -0,0 +1,149 @@
+/*
+ * Register-blocked float sums generated at compile time.
+ * blockedSum<Width, Accumulators, Shape> keeps Accumulators independent
+ * vectors of Width floats, so that the loop is limited by load bandwidth
+ * rather than by the latency of the add, and then combines them either
+ * linearly or as a tree (which is also a little more accurate).
+ * We use the GCC/Clang vector extensions, so the same code works for SSE,
+ * AVX, AVX-512 and NEON; a Width wider than the hardware's is simply split.
+ *
+ * Defaults are chosen per target at compile time; if the autotuner
+ * (tuneBlockedReduction) has been run and its output saved as
+ * blockedReductionTuned.h, its choices for each level of the memory
+ * hierarchy are used instead.
+ *
+ * License: Apache License v2.0 with LLVM Exceptions.
+ * See https://llvm.org/LICENSE.txt for license information.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+#ifndef REDUCTION_BLOCKED_REDUCTION_H
+#define REDUCTION_BLOCKED_REDUCTION_H
+
+#include <cstring>
+#include <utility>
+#include <omp.h>
+
+enum class combineShape {
+  linear,
+  tree,
+};
+
+struct blocking {
+  int width;
+  int accumulators;
+};
+
+template<int Width> struct floatVector {
+  typedef float type __attribute__((vector_size(Width * sizeof(float))));
+};
+
+// Combine values[0..count) into values[0].
+template<combineShape Shape, typename T> inline void combine(T * values,
+                                                             int count) {
+  if (Shape == combineShape::linear) {
+    for (int i=1; i<count; i++)
+      values[0] += values[i];
+  } else {
+    for (int stride=1; stride<count; stride *= 2)
+      for (int i=0; i+stride<count; i += 2*stride)
+        values[i] += values[i+stride];
+  }
+}
+
+template<typename V> inline void addVector(V & acc, float const * a) {
+  V v;
+  memcpy(&v, a, sizeof(v));
+  acc += v;
+}
+
+// The fold over the index sequence unrolls the accumulators explicitly,
+// rather than hoping that the compiler will.
+template<int Width, typename V, int... K>
+inline void accumulateBlock(V * acc, float const * a,
+                            std::integer_sequence<int, K...>) {
+  (addVector(acc[K], a + K*Width), ...);
+}
+
+template<int Width, int Accumulators,
+         combineShape Shape = combineShape::tree>
+float blockedSum(int n, float const * a) {
+  static_assert(Width > 0 && (Width & (Width-1)) == 0,
+                "Width must be a power of two");
+  static_assert(Accumulators > 0, "Need at least one accumulator");
+  typedef typename floatVector<Width>::type V;
+  enum { block = Width * Accumulators };
+
+  V acc[Accumulators] = {};
+  int i = 0;
+  for (; i + block <= n; i += block)
+    accumulateBlock<Width>(&acc[0], a + i,
+                           std::make_integer_sequence<int, Accumulators>());
+  combine<Shape>(&acc[0], Accumulators);
+
+  float lanes[Width];
+  memcpy(&lanes[0], &acc[0], sizeof(lanes));
+  combine<Shape>(&lanes[0], Width);
+
+  float total = lanes[0];
+  for (; i<n; i++)
+    total += a[i];
+  return total;
+}
+
+// In the style of parTot; each thread does a blocked sum of its chunk.
+template<int Width, int Accumulators,
+         combineShape Shape = combineShape::tree>
+float parBlockedSum(int n, float const * a) {
+  float total = 0.0;
+
+  #pragma omp parallel reduction(+:total)
+  {
+    int me = omp_get_thread_num();
+    int threads = omp_get_num_threads();
+    int begin = (long(n) * me) / threads;
+    int end = (long(n) * (me+1)) / threads;
+    total += blockedSum<Width, Accumulators, Shape>(end - begin, a + begin);
+  }
+  return total;
+}
+
+// Default choices per target: enough accumulators to cover the add latency
+// with the number of adds we can issue per cycle.
+#if (__AVX512F__)
+constexpr blocking defaultBlocking = {16, 8};
+#elif (__AVX__)
+constexpr blocking defaultBlocking = {8, 8};
+#elif (__ARM_NEON)
+constexpr blocking defaultBlocking = {4, 8};
+#else
+constexpr blocking defaultBlocking = {4, 4};
+#endif
+
+#if __has_include("blockedReductionTuned.h")
+#include "blockedReductionTuned.h"
+#else
+namespace blockedTuned {
+constexpr long l1Bytes = 32 * 1024;
+constexpr long l2Bytes = 1024 * 1024;
+constexpr blocking l1 = defaultBlocking;
+constexpr blocking l2 = defaultBlocking;
+constexpr blocking dram = defaultBlocking;
+} // namespace blockedTuned
+#endif
+
+// Pick the tuned variant for where the data is likely to be.
+inline float blockedTot(int n, float const * a) {
+  using namespace blockedTuned;
+  long bytes = long(n) * sizeof(float);
+  if (bytes <= l1Bytes)
+    return blockedSum<l1.width, l1.accumulators>(n, a);
+  if (bytes <= l2Bytes)
+    return blockedSum<l2.width, l2.accumulators>(n, a);
+  return blockedSum<dram.width, dram.accumulators>(n, a);
+}
+
+inline float parBlockedTot(int n, float const * a) {
+  using namespace blockedTuned;
+  return parBlockedSum<dram.width, dram.accumulators>(n, a);
+}
+#endif
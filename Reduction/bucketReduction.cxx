@@ -0,0 +1,85 @@
+/*
+ * Compare the exponent-bucketed parallel reduction with orderedReduction:
+ * how close does it get to its accuracy, and how much faster is it?
+ *
+ * License: Apache License v2.0 with LLVM Exceptions.
+ * See https://llvm.org/LICENSE.txt for license information.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <omp.h>
+
+#include "accurateSums.h"
+#include "distributions.h"
+#include "reductions.h"
+
+enum { repeats = 5 };
+
+template<typename Op> static double bestTime(Op op, double * result) {
+  double best = 1.e30;
+  for (int r=0; r<repeats; r++) {
+    double start = omp_get_wtime();
+    *result = op();
+    best = std::min(best, omp_get_wtime() - start);
+  }
+  return best;
+}
+
+static double relativeError(double value, double exact) {
+  double error = std::abs(value - exact);
+  return exact != 0.0 ? error / std::abs(exact) : error;
+}
+
+int main(int argc, char ** argv) {
+  // orderedReduction is O(n log n) and allocates a node per element, so
+  // don't make this too big.
+  int n = argc > 1 ? atoi(argv[1]) : 100002;
+  int maxThreads = omp_get_max_threads();
+  float * data = new float[n];
+
+  printf("%d elements, omp_get_max_threads() %d\n", n, maxThreads);
+  printf("Relative error against the exact sum (result rounded to float),\n"
+         "the bucketed sum's difference from orderedReduction's, and which of\n"
+         "those two is closer to the exact sum\n");
+  printf("%-15s %10s %10s %10s %10s %10s %9s\n", "Distribution", "parTot",
+         "parTotDA", "ordered", "bucketed", "vsOrdered", "Closer");
+  for (auto const & dist : distributions) {
+    dist.init(n, data, 0);
+    double exact = float(accumulateTot<exactAccumulator>(n, data));
+    double ordered = orderedReduction(n, data);
+    double bucketed = float(bucketedTot(n, data));
+    double orderedError = relativeError(ordered, exact);
+    double bucketedError = relativeError(bucketed, exact);
+    printf("%-15s %10.2e %10.2e %10.2e %10.2e %10.2e %9s\n", dist.name,
+           relativeError(parTot(n, data), exact),
+           relativeError(parTotDA(n, data), exact),
+           orderedError, bucketedError, relativeError(bucketed, ordered),
+           bucketedError < orderedError ? "bucketed" :
+           orderedError < bucketedError ? "ordered" : "same");
+  }
+
+  initUniform(n, data, 0);
+  double result;
+  double orderedTime = bestTime([&]() {
+    return orderedReduction(n, data);
+  }, &result);
+  printf("\nTime (ms) and speedup over orderedReduction (%.3f ms)\n",
+         orderedTime * 1.e3);
+  printf("%8s %10s %10s %10s\n", "Threads", "Time", "vsOrdered", "vs1Thread");
+  double oneThread = 0.0;
+  for (int threads=1; ; threads = std::min(2*threads, maxThreads)) {
+    omp_set_num_threads(threads);
+    double time = bestTime([&]() { return bucketedTot(n, data); }, &result);
+    if (threads == 1)
+      oneThread = time;
+    printf("%8d %10.3f %10.1f %10.2f\n", threads, time * 1.e3,
+           orderedTime / time, oneThread / time);
+    if (threads == maxThreads)
+      break;
+  }
+  delete [] data;
+  return 0;
+}
@@ -0,0 +1,104 @@
+/*
+ * Input distributions used to exercise the reduction codes.
+ * Each generator fills an array of floats; the seed lets us run several
+ * independent trials of the random ones.
+ *
+ * License: Apache License v2.0 with LLVM Exceptions.
+ * See https://llvm.org/LICENSE.txt for license information.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+#ifndef REDUCTION_DISTRIBUTIONS_H
+#define REDUCTION_DISTRIBUTIONS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+// The pattern from sumReduction's initArray: one big value, lots of tiny ones
+// which a float accumulator simply drops, and then the big value cancelled.
+inline void initCancelling(int n, float * a, unsigned) {
+  a[0] = 1.0;
+  a[n-1] = -1.0;
+  for (int i=1; i<n-1; i++) {
+    a[i] = 2.e-8;
+  }
+}
+
+// All positive, similar magnitudes; the friendliest case there is.
+inline void initUniform(int n, float * a, unsigned seed) {
+  std::mt19937 gen(seed);
+  std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+  for (int i=0; i<n; i++) {
+    a[i] = dist(gen);
+  }
+}
+
+// Mixed signs, so the result is O(sqrt(n)) while sum(|a|) is O(n).
+inline void initSymmetric(int n, float * a, unsigned seed) {
+  std::mt19937 gen(seed);
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+  for (int i=0; i<n; i++) {
+    a[i] = dist(gen);
+  }
+}
+
+// Random signs and magnitudes spread over many binades.
+inline void initWideRange(int n, float * a, unsigned seed) {
+  std::mt19937 gen(seed);
+  std::uniform_real_distribution<float> mantissa(1.0f, 2.0f);
+  std::uniform_int_distribution<int> exponent(-40, 40);
+  std::bernoulli_distribution negative(0.5);
+  for (int i=0; i<n; i++) {
+    float v = std::ldexp(mantissa(gen), exponent(gen));
+    a[i] = negative(gen) ? -v : v;
+  }
+}
+
+// Values and their negations, shuffled, plus a handful of tiny terms, so the
+// true sum is minute compared with the terms. (Essentially the GenSum idea
+// from Ogita, Rump and Oishi.)
+inline void initIllConditioned(int n, float * a, unsigned seed) {
+  std::mt19937 gen(seed);
+  std::uniform_real_distribution<float> mantissa(1.0f, 2.0f);
+  std::uniform_int_distribution<int> exponent(-10, 20);
+  int tail = n & 1;
+  int pairs = (n - tail) / 2;
+
+  for (int i=0; i<pairs; i++) {
+    float v = std::ldexp(mantissa(gen), exponent(gen));
+    a[2*i] = v;
+    a[2*i+1] = -v;
+  }
+  // Perturb a few of the values so that the sum is not exactly zero.
+  for (int i=0; i<std::min(8, pairs); i++) {
+    a[2*i] = std::nextafter(a[2*i], 0.0f);
+  }
+  if (tail) {
+    a[n-1] = 1.e-6f;
+  }
+  std::shuffle(a, a+n, gen);
+}
+
+// Yes, this could be a std::map, but (as in omp_scan) a table we scan
+// is all we need.
+static struct distribution_t {
+  char const * name;
+  void (*init)(int, float *, unsigned);
+} distributions[] = {
+  {"cancelling", initCancelling},
+  {"uniform", initUniform},
+  {"symmetric", initSymmetric},
+  {"wideRange", initWideRange},
+  {"illConditioned", initIllConditioned},
+};
+
+inline distribution_t const * findDistribution(char const * name) {
+  for (auto const & d : distributions) {
+    if (strcmp(d.name, name) == 0) {
+      return &d;
+    }
+  }
+  return 0;
+}
+#endif
@@ -0,0 +1,103 @@
+/*
+ * How much does it cost to materialize the values we are about to reduce?
+ * Compare filling a temporary and then reducing it with the fused
+ * (expression template) reduction for a few typical cases.
+ *
+ * License: Apache License v2.0 with LLVM Exceptions.
+ * See https://llvm.org/LICENSE.txt for license information.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <omp.h>
+
+#include "distributions.h"
+#include "fusedReduce.h"
+
+enum { repeats = 10 };
+
+// Best time for a call of op, and its result.
+template<typename Op> static double bestTime(Op op, double * result) {
+  double best = 1.e30;
+  for (int r=0; r<repeats; r++) {
+    double start = omp_get_wtime();
+    *result = op();
+    best = std::min(best, omp_get_wtime() - start);
+  }
+  return best;
+}
+
+// Run one case both ways. inputBytes is what both versions have to read;
+// the materialized version also has to write and then re-read the
+// temporary.
+template<typename E>
+static void compare(char const * name, E const & expr, float * temporary,
+                    double inputBytes) {
+  using namespace fused;
+  int n = expr.size();
+  double materialized, fusedResult;
+
+  double materializeTime = bestTime([&]() {
+    materialize(expr, temporary);
+    return reduce(view(n, temporary), 0.0);
+  }, &materialized);
+  double fusedTime = bestTime([&]() {
+    return reduce(expr, 0.0);
+  }, &fusedResult);
+
+  double tempBytes = 2.0 * n * sizeof(float);
+  printf("%-12s %10.3f %10.3f %8.2fx %10.2f %10.2f  %s\n", name,
+         materializeTime * 1.e3, fusedTime * 1.e3,
+         materializeTime / fusedTime,
+         (inputBytes + tempBytes) / materializeTime * 1.e-9,
+         tempBytes * 1.e-6,
+         materialized == fusedResult ? "" : "(results differ in rounding)");
+}
+
+int main(int argc, char ** argv) {
+  using namespace fused;
+  int n = argc > 1 ? atoi(argv[1]) : (1 << 25);
+  float * a = new float[n];
+  float * b = new float[n];
+  float * temporary = new float[n];
+  initUniform(n, a, 1);
+  initSymmetric(n, b, 2);
+  // Touch the temporary so that we aren't timing page faults.
+  std::fill(temporary, temporary + n, 0.0f);
+
+  printf("omp_get_max_threads() %d, %d elements\n", omp_get_max_threads(), n);
+  printf("%-12s %10s %10s %9s %10s %10s\n", "Case", "Mat. (ms)",
+         "Fused (ms)", "Speedup", "Mat. GB/s", "Saved MB");
+
+  // sumReduction's initArray, generated rather than stored.
+  auto pattern = generate(n, [n](int i) {
+    return i == 0 ? 1.0f : (i == n-1 ? -1.0f : 2.e-8f);
+  });
+  compare("initArray", pattern, temporary, 0.0);
+
+  auto dot = transform(view(n, a), view(n, b),
+                       [](float x, float y) { return x*y; });
+  compare("a[i]*b[i]", dot, temporary, 2.0 * n * sizeof(float));
+
+  auto squares = transform(view(n, a), [](float x) { return x*x; });
+  compare("a[i]^2", squares, temporary, 1.0 * n * sizeof(float));
+
+  // Unless you compile with -fno-math-errno, sqrt may have to set errno,
+  // which stops the fused loop being vectorised, so this one can lose.
+  auto roots = transform(view(n, a), [](float x) { return std::sqrt(x); });
+  compare("sqrt(a[i])", roots, temporary, 1.0 * n * sizeof(float));
+
+  // Two transforms deep.
+  float mean = reduce(view(n, a), 0.0) / n;
+  auto variance = transform(transform(view(n, a),
+                                      [mean](float x) { return x - mean; }),
+                            [](float x) { return x*x; });
+  compare("(a[i]-m)^2", variance, temporary, 1.0 * n * sizeof(float));
+
+  delete [] a;
+  delete [] b;
+  delete [] temporary;
+  return 0;
+}
@@ -0,0 +1,128 @@
+/*
+ * Lazy expressions and generators, so that a reduction over computed values
+ * compiles into one fused loop rather than filling an array and then
+ * reducing it.
+ *
+ *   reduce(transform(view(n, a), view(n, b), [](float x, float y) {
+ *            return x*y; }), 0.0)
+ *
+ * is a single parallel, vectorised loop over a and b, with no temporary.
+ * Expressions are small value types, holding only pointers, lambdas and a
+ * length; the work happens only in reduce (or materialize).
+ *
+ * License: Apache License v2.0 with LLVM Exceptions.
+ * See https://llvm.org/LICENSE.txt for license information.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+#ifndef REDUCTION_FUSED_REDUCE_H
+#define REDUCTION_FUSED_REDUCE_H
+
+#include <utility>
+#include <omp.h>
+
+namespace fused {
+// Every expression has
+//   size()        the number of elements
+//   operator[](i) element i, computed on demand
+//   valueType     the type of the elements
+
+// An existing array.
+template<typename T> class arrayExpr {
+  int n;
+  T const * a;
+ public:
+  typedef T valueType;
+  arrayExpr(int size, T const * data) : n(size), a(data) {}
+
+  int size() const { return n; }
+  T operator[](int i) const { return a[i]; }
+};
+
+// Element i is f(i); nothing is stored at all.
+template<typename F> class generatorExpr {
+  int n;
+  F f;
+ public:
+  typedef decltype(std::declval<F>()(0)) valueType;
+  generatorExpr(int size, F fn) : n(size), f(fn) {}
+
+  int size() const { return n; }
+  valueType operator[](int i) const { return f(i); }
+};
+
+// Element i is f(e[i]).
+template<typename E, typename F> class unaryExpr {
+  E e;
+  F f;
+ public:
+  typedef decltype(std::declval<F>()(std::declval<typename E::valueType>()))
+      valueType;
+  unaryExpr(E expr, F fn) : e(expr), f(fn) {}
+
+  int size() const { return e.size(); }
+  valueType operator[](int i) const { return f(e[i]); }
+};
+
+// Element i is f(e1[i], e2[i]). The two must be the same size.
+template<typename E1, typename E2, typename F> class binaryExpr {
+  E1 e1;
+  E2 e2;
+  F f;
+ public:
+  typedef decltype(std::declval<F>()(std::declval<typename E1::valueType>(),
+                                     std::declval<typename E2::valueType>()))
+      valueType;
+  binaryExpr(E1 expr1, E2 expr2, F fn) : e1(expr1), e2(expr2), f(fn) {}
+
+  int size() const { return e1.size(); }
+  valueType operator[](int i) const { return f(e1[i], e2[i]); }
+};
+
+template<typename T> arrayExpr<T> view(int n, T const * a) {
+  return arrayExpr<T>(n, a);
+}
+
+template<typename F> generatorExpr<F> generate(int n, F f) {
+  return generatorExpr<F>(n, f);
+}
+
+template<typename E, typename F> unaryExpr<E, F> transform(E e, F f) {
+  return unaryExpr<E, F>(e, f);
+}
+
+template<typename E1, typename E2, typename F>
+binaryExpr<E1, E2, F> transform(E1 e1, E2 e2, F f) {
+  return binaryExpr<E1, E2, F>(e1, e2, f);
+}
+
+// The sum of the expression. As with std::reduce, the type of init is the
+// type we accumulate in, so pass 0.0 to get a double accumulator.
+// The simd reduction explicitly allows reassociation, so (unlike parTot,
+// which the compiler won't vectorise without -ffast-math) this is
+// vectorised.
+template<typename E, typename T> T reduce(E const & e, T init) {
+  T total = init;
+  int n = e.size();
+
+  #pragma omp parallel for simd reduction(+:total)
+  for (int i=0; i<n; i++)
+    total += e[i];
+
+  return total;
+}
+
+template<typename E> typename E::valueType reduce(E const & e) {
+  return reduce(e, typename E::valueType(0));
+}
+
+// Evaluate the expression into memory; what we are trying to avoid, but
+// useful for comparison.
+template<typename E> void materialize(E const & e, typename E::valueType * out) {
+  int n = e.size();
+
+  #pragma omp parallel for simd
+  for (int i=0; i<n; i++)
+    out[i] = e[i];
+}
+} // namespace fused
+#endif
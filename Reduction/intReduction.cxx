@@ -0,0 +1,204 @@
+/*
+ * Integer and fixed-point sums.
+ * Integer addition is associative, so these can be vectorised and run in
+ * parallel in any order and still give bitwise identical results; the only
+ * problem is overflow. Rather than check every addition, we accumulate in
+ * wide enough types that the partial sums cannot overflow, and check the
+ * final result once.
+ *
+ * License: Apache License v2.0 with LLVM Exceptions.
+ * See https://llvm.org/LICENSE.txt for license information.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <omp.h>
+
+#include "distributions.h"
+#include "reductions.h"
+
+// int32 values widened into int64 lanes. With fewer than 2^31 elements the
+// total is less than 2^62 in magnitude, so this cannot overflow, and we
+// only need to check whether the result fits in int32 if that's what the
+// caller wants.
+static int64_t parTotI32(int n, int32_t const * a) {
+  int64_t total = 0;
+
+  #pragma omp parallel for simd reduction(+:total)
+  for (int i=0; i<n; i++)
+    total += a[i];
+
+  return total;
+}
+
+struct checkedInt32 {
+  int32_t value;
+  bool overflow;
+};
+
+static checkedInt32 checkedTotI32(int n, int32_t const * a) {
+  int64_t total = parTotI32(n, a);
+  return {int32_t(total),
+          total < std::numeric_limits<int32_t>::min() ||
+          total > std::numeric_limits<int32_t>::max()};
+}
+
+// For int64 values there is no wider type we can vectorise over, so split
+// each value into its (signed) high and (unsigned) low 32 bits and sum those
+// separately, in int64 lanes. Again, neither sum can overflow with fewer than
+// 2^31 elements, and the exact result is hi*2^32 + lo, which we assemble in
+// 128 bits. Intermediate overflow doesn't matter at all; only whether the
+// final value fits.
+struct checkedInt64 {
+  int64_t value;    // The wrapped (two's complement) result
+  bool overflow;
+};
+
+static checkedInt64 checkedTotI64(int n, int64_t const * a) {
+  int64_t high = 0;
+  int64_t low = 0;
+
+  #pragma omp parallel for simd reduction(+:high,low)
+  for (int i=0; i<n; i++) {
+    high += a[i] >> 32;
+    low += a[i] & 0xffffffff;
+  }
+
+  __int128 total = __int128(high) * (__int128(1) << 32) + low;
+  return {int64_t(uint64_t(total)),
+          total < std::numeric_limits<int64_t>::min() ||
+          total > std::numeric_limits<int64_t>::max()};
+}
+
+// Fixed point values with fracBits fractional bits in an int32.
+template<int fracBits> class fixed32 {
+ public:
+  // Round to nearest even; rounding ties away from zero biases the sum.
+  static int32_t fromFloat(float v) {
+    return int32_t(std::lrint(std::ldexp(v, fracBits)));
+  }
+  static double toDouble(int64_t raw) {
+    return std::ldexp(double(raw), -fracBits);
+  }
+};
+typedef fixed32<16> q16_16;
+
+enum { repeats = 10 };
+
+template<typename Op> static double bestTime(Op op) {
+  double best = 1.e30;
+  for (int r=0; r<repeats; r++) {
+    double start = omp_get_wtime();
+    op();
+    best = std::min(best, omp_get_wtime() - start);
+  }
+  return best;
+}
+
+// Do we get the same bits whatever the number of threads?
+template<typename Op> static bool reproducible(Op op, int maxThreads) {
+  omp_set_num_threads(1);
+  auto reference = op();
+  bool same = true;
+  for (int threads=2; threads<=maxThreads; threads++) {
+    omp_set_num_threads(threads);
+    auto value = op();
+    same = same && memcmp(&value, &reference, sizeof(value)) == 0;
+  }
+  omp_set_num_threads(maxThreads);
+  return same;
+}
+
+int main(int argc, char ** argv) {
+  int n = argc > 1 ? atoi(argv[1]) : (1 << 24);
+  int maxThreads = omp_get_max_threads();
+  // Check reproducibility with at least a few threads, even if we're on a
+  // small machine.
+  int checkThreads = std::max(maxThreads, 8);
+  int32_t * i32 = new int32_t[n];
+  int64_t * i64 = new int64_t[n];
+  int32_t * q = new int32_t[n];
+  float * f = new float[n];
+
+  std::mt19937 gen(1);
+  std::uniform_int_distribution<int32_t> dist32(
+      std::numeric_limits<int32_t>::min(), std::numeric_limits<int32_t>::max());
+  std::uniform_int_distribution<int64_t> dist64(
+      std::numeric_limits<int64_t>::min() / 2,
+      std::numeric_limits<int64_t>::max() / 2);
+  for (int i=0; i<n; i++) {
+    i32[i] = dist32(gen);
+    i64[i] = dist64(gen);
+  }
+  initSymmetric(n, f, 1);
+  for (int i=0; i<n; i++)
+    q[i] = q16_16::fromFloat(f[i]);
+
+  printf("%d elements, omp_get_max_threads() %d\n", n, maxThreads);
+
+  // Overflow detection.
+  checkedInt32 c32 = checkedTotI32(n, i32);
+  printf("int32 sum %lld %s int32\n", (long long)parTotI32(n, i32),
+         c32.overflow ? "overflows" : "fits in");
+  checkedInt64 c64 = checkedTotI64(n, i64);
+  printf("int64 sum %s int64\n", c64.overflow ? "overflows" : "fits in");
+  // Partial sums which overflow, but a final result which does not.
+  int64_t big[4] = {std::numeric_limits<int64_t>::max(),
+                    std::numeric_limits<int64_t>::max(),
+                    -std::numeric_limits<int64_t>::max(),
+                    -std::numeric_limits<int64_t>::max()};
+  c64 = checkedTotI64(4, big);
+  printf("max+max-max-max = %lld, %s\n", (long long)c64.value,
+         c64.overflow ? "overflow (wrong!)" : "no overflow (right)");
+  big[2] = 1;
+  c64 = checkedTotI64(4, big);
+  printf("max+max+1-max overflows? %s\n", c64.overflow ? "yes (right)" :
+         "no (wrong!)");
+
+  printf("\nQ16.16 sum %.9g, float parTot %.9g, parTotDA %.9g\n",
+         q16_16::toDouble(parTotI32(n, q)), parTot(n, f), parTotDA(n, f));
+
+  printf("\n%-16s %10s %14s\n", "Kernel", "ns/elt", "Reproducible");
+  struct {
+    char const * name;
+    double time;
+    bool reproducible;
+  } results[] = {
+    {"int32->int64",
+     bestTime([&]() { return parTotI32(n, i32); }),
+     reproducible([&]() { return parTotI32(n, i32); }, checkThreads)},
+    {"int32 checked",
+     bestTime([&]() { return checkedTotI32(n, i32); }),
+     reproducible([&]() { return checkedTotI32(n, i32).value; },
+                  checkThreads)},
+    {"int64 checked",
+     bestTime([&]() { return checkedTotI64(n, i64); }),
+     reproducible([&]() { return checkedTotI64(n, i64).value; },
+                  checkThreads)},
+    {"Q16.16",
+     bestTime([&]() { return parTotI32(n, q); }),
+     reproducible([&]() { return parTotI32(n, q); }, checkThreads)},
+    {"float parTot",
+     bestTime([&]() { return parTot(n, f); }),
+     reproducible([&]() { return parTot(n, f); }, checkThreads)},
+    {"float parTotDA",
+     bestTime([&]() { return parTotDA(n, f); }),
+     reproducible([&]() { return parTotDA(n, f); }, checkThreads)},
+  };
+  for (auto const & r : results) {
+    printf("%-16s %10.3f %14s\n", r.name, r.time / n * 1.e9,
+           r.reproducible ? "yes" : "no");
+  }
+
+  delete [] i32;
+  delete [] i64;
+  delete [] q;
+  delete [] f;
+  return 0;
+}
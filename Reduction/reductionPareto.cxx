@@ -0,0 +1,210 @@
+/*
+ * Run every reduction we have over each input distribution at a range of
+ * sizes, measure its relative error against the exact sum and its time per
+ * element, and show the Pareto frontier (the variants for which nothing
+ * else is both faster and at least as accurate).
+ * Given an error budget, it also picks the cheapest variant which meets it.
+ *
+ * Usage: reductionPareto [--budget=relErr] [--sizes=n,n,...] [--trials=t]
+ *                        [--csv]
+ *
+ * License: Apache License v2.0 with LLVM Exceptions.
+ * See https://llvm.org/LICENSE.txt for license information.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <omp.h>
+
+#include "accurateSums.h"
+#include "blockedReduction.h"
+#include "distributions.h"
+#include "fusedReduce.h"
+#include "reductions.h"
+
+// The tolerance we ask the adaptive sums for.
+static double const adaptiveTolerance = 1.e-6;
+
+static struct variant_t {
+  char const * name;
+  double (*method)(int, float const *);
+  int maxElements; // Beyond this it's too slow to bother with.
+} variants[] = {
+  {"serTot", [](int n, float const * a) -> double { return serTot(n, a); },
+   0},
+  {"serTotDA", [](int n, float const * a) -> double { return serTotDA(n, a); },
+   0},
+  {"serialTotDA", [](int n, float const * a) -> double {
+     return serialTotDA(n, a);
+   }, 0},
+  {"parTot", [](int n, float const * a) -> double { return parTot(n, a); },
+   0},
+  {"parTotDA", [](int n, float const * a) -> double { return parTotDA(n, a); },
+   0},
+  {"simdTot", [](int n, float const * a) -> double {
+     return fused::reduce(fused::view(n, a));
+   }, 0},
+  {"simdTotDA", [](int n, float const * a) -> double {
+     return fused::reduce(fused::view(n, a), 0.0);
+   }, 0},
+  {"blocked", [](int n, float const * a) -> double {
+     return blockedTot(n, a);
+   }, 0},
+  {"parBlocked", [](int n, float const * a) -> double {
+     return parBlockedTot(n, a);
+   }, 0},
+  {"compensated", accumulateTot<compensatedAccumulator>, 0},
+  {"bucketed", bucketedTot, 0},
+  {"adaptiveF", [](int n, float const * a) {
+     return adaptiveTot<float>(n, a, adaptiveTolerance).value;
+   }, 0},
+  {"adaptiveD", [](int n, float const * a) {
+     return adaptiveTot<double>(n, a, adaptiveTolerance).value;
+   }, 0},
+  {"exact", accumulateTot<exactAccumulator>, 0},
+  {"ordered", [](int n, float const * a) -> double {
+     return orderedReduction(n, a);
+   }, 1000000},
+};
+
+struct measurement {
+  variant_t const * variant;
+  double relError;    // Worst over the trials
+  double timePerElt;  // Best over the trials
+  bool pareto;
+};
+
+// Mark the measurements which are not dominated by any other.
+static void findFrontier(std::vector<measurement> & results) {
+  for (auto & m : results) {
+    m.pareto = true;
+    for (auto const & other : results) {
+      if (&other != &m &&
+          other.relError <= m.relError && other.timePerElt <= m.timePerElt &&
+          (other.relError < m.relError || other.timePerElt < m.timePerElt)) {
+        m.pareto = false;
+        break;
+      }
+    }
+  }
+}
+
+static std::vector<measurement> measure(distribution_t const & dist, int n,
+                                        float * data, int trials) {
+  std::vector<measurement> results;
+  for (auto const & v : variants) {
+    if (v.maxElements == 0 || n <= v.maxElements) {
+      results.push_back({&v, 0.0, 1.e30, false});
+    }
+  }
+
+  // Repeat small cases so that there's something measurable.
+  int calls = std::max(1, 100000 / n);
+  for (int t=0; t<trials; t++) {
+    dist.init(n, data, t);
+    // Round the reference to float, as that's what the user gets.
+    double exact = float(accumulateTot<exactAccumulator>(n, data));
+    for (auto & m : results) {
+      double value = 0.0;
+      double start = omp_get_wtime();
+      for (int c=0; c<calls; c++)
+        value = float(m.variant->method(n, data));
+      double elapsed = (omp_get_wtime() - start) / calls;
+      double error = std::abs(value - exact);
+      double relError = exact != 0.0 ? error / std::abs(exact) : error;
+      m.relError = std::max(m.relError, relError);
+      m.timePerElt = std::min(m.timePerElt, elapsed / n);
+    }
+  }
+  findFrontier(results);
+  std::sort(results.begin(), results.end(),
+            [](measurement const & a, measurement const & b) {
+              return a.timePerElt < b.timePerElt;
+            });
+  return results;
+}
+
+int main(int argc, char ** argv) {
+  double budget = -1.0;
+  int trials = 5;
+  bool csv = false;
+  std::vector<int> sizes = {1000, 100000, 10000000};
+
+  bool valid = true;
+  for (int i=1; i<argc && valid; i++) {
+    if (strncmp(argv[i], "--budget=", 9) == 0) {
+      budget = atof(argv[i] + 9);
+    } else if (strncmp(argv[i], "--trials=", 9) == 0) {
+      trials = std::max(1, atoi(argv[i] + 9));
+    } else if (strncmp(argv[i], "--sizes=", 8) == 0) {
+      // A non-empty list of positive sizes, separated by commas.
+      sizes.clear();
+      char * p = argv[i] + 8;
+      do {
+        char * end;
+        long n = strtol(p, &end, 10);
+        if (end == p || n <= 0 || n > 0x7fffffff) {
+          valid = false;
+          break;
+        }
+        sizes.push_back(int(n));
+        p = end;
+      } while (*p++ == ',');
+      valid = valid && p[-1] == '\0';
+    } else if (strcmp(argv[i], "--csv") == 0) {
+      csv = true;
+    } else {
+      valid = false;
+    }
+  }
+  if (!valid) {
+    fprintf(stderr, "Usage: %s [--budget=relErr] [--sizes=n,n,...] "
+            "[--trials=t] [--csv]\n", argv[0]);
+    return 1;
+  }
+
+  int maxSize = *std::max_element(sizes.begin(), sizes.end());
+  float * data = new float[maxSize];
+
+  if (csv) {
+    printf("Distribution, Elements, Variant, RelError, ns/element, Pareto\n");
+  } else {
+    printf("omp_get_max_threads() %d, %d trials; * marks the Pareto frontier\n",
+           omp_get_max_threads(), trials);
+  }
+  for (auto const & dist : distributions) {
+    for (int n : sizes) {
+      if (n < 2)
+        continue;
+      auto results = measure(dist, n, data, trials);
+      if (!csv) {
+        printf("\n%s, %d elements\n%-12s %10s %10s\n", dist.name, n,
+               "Variant", "RelError", "ns/elt");
+      }
+      for (auto const & m : results) {
+        if (csv) {
+          printf("%s, %d, %s, %g, %g, %d\n", dist.name, n, m.variant->name,
+                 m.relError, m.timePerElt * 1.e9, m.pareto);
+        } else {
+          printf("%-12s %10.2e %10.3f %s\n", m.variant->name, m.relError,
+                 m.timePerElt * 1.e9, m.pareto ? "*" : "");
+        }
+      }
+      if (budget >= 0.0 && !csv) {
+        // Sorted by time, so the first that meets the budget is cheapest.
+        auto best = std::find_if(results.begin(), results.end(),
+                                 [budget](measurement const & m) {
+                                   return m.relError <= budget;
+                                 });
+        printf("Cheapest within %g: %s\n", budget,
+               best != results.end() ? best->variant->name : "none");
+      }
+    }
+  }
+  delete [] data;
+  return 0;
+}
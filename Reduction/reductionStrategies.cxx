@@ -0,0 +1,241 @@
+/*
+ * The same parallel float sum, combined in each of the ways OpenMP lets us
+ * (and a few we have to build ourselves), timed across thread counts and
+ * the amount of work each thread does, so that we can see where the cost of
+ * combining the per-thread results starts to matter.
+ *
+ * License: Apache License v2.0 with LLVM Exceptions.
+ * See https://llvm.org/LICENSE.txt for license information.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <omp.h>
+
+// Big enough for current x86_64 and most Arm cores (Apple's are 128B).
+enum { cacheLineSize = 64 };
+
+// The reduction clause, exactly as parTot in sumReduction.cxx.
+static float clauseTot(int threads, int n, float const * a) {
+  float total = 0.0;
+
+  #pragma omp parallel for num_threads(threads) reduction(+:total)
+  for (int i=0; i<n; i++)
+    total += a[i];
+
+  return total;
+}
+
+// Sum locally, then combine in a critical section, as omp_scan does.
+static float criticalTot(int threads, int n, float const * a) {
+  float total = 0.0;
+
+  #pragma omp parallel num_threads(threads)
+  {
+    float mine = 0.0;
+    #pragma omp for nowait
+    for (int i=0; i<n; i++)
+      mine += a[i];
+
+    #pragma omp critical (criticalTot)
+    total += mine;
+  }
+  return total;
+}
+
+// Sum locally, then combine with an OpenMP atomic.
+static float ompAtomicTot(int threads, int n, float const * a) {
+  float total = 0.0;
+
+  #pragma omp parallel num_threads(threads)
+  {
+    float mine = 0.0;
+    #pragma omp for nowait
+    for (int i=0; i<n; i++)
+      mine += a[i];
+
+    #pragma omp atomic
+    total += mine;
+  }
+  return total;
+}
+
+// There is no hardware floating point atomic add on x86_64, so this is what
+// the compiler has to do for the OpenMP atomic anyway; written out here
+// so that we know what we are measuring.
+static void casAdd(std::atomic<float> & target, float value) {
+  float expected = target.load(std::memory_order_relaxed);
+  while (!target.compare_exchange_weak(expected, expected + value,
+                                       std::memory_order_relaxed)) {
+    // expected has been updated with the current value, so just retry.
+  }
+}
+
+static float casAtomicTot(int threads, int n, float const * a) {
+  std::atomic<float> total(0.0);
+
+  #pragma omp parallel num_threads(threads) shared(total)
+  {
+    float mine = 0.0;
+    #pragma omp for nowait
+    for (int i=0; i<n; i++)
+      mine += a[i];
+
+    casAdd(total, mine);
+  }
+  return total;
+}
+
+// Per-thread slots in a shared array, updated on every iteration (which is
+// what people write when they translate a serial code literally).
+// Adjacent slots share a cache line, so this shows false sharing.
+static float unpaddedTot(int threads, int n, float const * a) {
+  float * partial = new float[threads];
+
+  #pragma omp parallel num_threads(threads)
+  {
+    int me = omp_get_thread_num();
+    partial[me] = 0.0;
+    #pragma omp for
+    for (int i=0; i<n; i++)
+      partial[me] += a[i];
+    // Implicit barrier at the end of the for
+  }
+  float total = 0.0;
+  for (int i=0; i<threads; i++)
+    total += partial[i];
+
+  delete [] partial;
+  return total;
+}
+
+// The same, but with each slot in its own cache line.
+struct alignas(cacheLineSize) paddedFloat {
+  float value;
+};
+
+static float paddedTot(int threads, int n, float const * a) {
+  paddedFloat * partial = new paddedFloat[threads];
+
+  #pragma omp parallel num_threads(threads)
+  {
+    int me = omp_get_thread_num();
+    partial[me].value = 0.0;
+    #pragma omp for
+    for (int i=0; i<n; i++)
+      partial[me].value += a[i];
+  }
+  float total = 0.0;
+  for (int i=0; i<threads; i++)
+    total += partial[i].value;
+
+  delete [] partial;
+  return total;
+}
+
+// A log-depth combining tree. At each level thread me (when a multiple of
+// 2*stride) adds in the result from thread me+stride; we need a barrier
+// between levels so that the value we read is complete.
+static float treeTot(int threads, int n, float const * a) {
+  paddedFloat * partial = new paddedFloat[threads];
+
+  #pragma omp parallel num_threads(threads)
+  {
+    int me = omp_get_thread_num();
+    int nThreads = omp_get_num_threads();
+    float mine = 0.0;
+    #pragma omp for nowait
+    for (int i=0; i<n; i++)
+      mine += a[i];
+    partial[me].value = mine;
+
+    for (int stride=1; stride<nThreads; stride *= 2) {
+      #pragma omp barrier
+      if ((me % (2*stride)) == 0 && me + stride < nThreads) {
+        partial[me].value += partial[me + stride].value;
+      }
+    }
+  }
+  float total = partial[0].value;
+
+  delete [] partial;
+  return total;
+}
+
+static struct strategy_t {
+  char const * name;
+  float (*method)(int, int, float const *);
+} strategies[] = {
+  {"clause", clauseTot},
+  {"critical", criticalTot},
+  {"ompAtomic", ompAtomicTot},
+  {"casAtomic", casAtomicTot},
+  {"unpadded", unpaddedTot},
+  {"padded", paddedTot},
+  {"tree", treeTot},
+};
+
+// Best time per call over a few samples, each of which runs enough calls to
+// be measurable.
+static double timeStrategy(strategy_t const & s, int threads, int n,
+                           float const * a) {
+  enum { samples = 5 };
+  int calls = std::max(1, (1 << 22) / std::max(n, 1));
+  calls = std::min(calls, 1000);
+  double best = 1.e30;
+  volatile float sink;
+
+  // Warm up, get the threads created, and check the answer. (The data is
+  // all ones, so the result is exact.)
+  if (s.method(threads, n, a) != float(n)) {
+    fprintf(stderr, "%s gave the wrong answer with %d threads\n", s.name,
+            threads);
+  }
+  for (int sample=0; sample<samples; sample++) {
+    double start = omp_get_wtime();
+    for (int c=0; c<calls; c++)
+      sink = s.method(threads, n, a);
+    best = std::min(best, (omp_get_wtime() - start) / calls);
+  }
+  (void)sink;
+  return best;
+}
+
+int main(int argc, char ** argv) {
+  int maxThreads = argc > 1 ? atoi(argv[1]) : omp_get_max_threads();
+  static int const workPerThread[] = {1, 16, 256, 4096, 65536, 1048576};
+  int threadCounts[32];
+  int numThreadCounts = 0;
+
+  for (int t=1; t<maxThreads; t *= 2)
+    threadCounts[numThreadCounts++] = t;
+  threadCounts[numThreadCounts++] = maxThreads;
+
+  int maxElements = maxThreads * workPerThread[sizeof(workPerThread)/
+                                               sizeof(workPerThread[0]) - 1];
+  float * data = new float[maxElements];
+  for (int i=0; i<maxElements; i++)
+    data[i] = 1.0;
+
+  printf("Time per reduction (us), omp_get_max_threads() %d\n",
+         omp_get_max_threads());
+  for (int work : workPerThread) {
+    printf("\n%d elements per thread\n%-10s", work, "Strategy");
+    for (int t=0; t<numThreadCounts; t++)
+      printf(" %10d", threadCounts[t]);
+    printf("\n");
+    for (auto const & s : strategies) {
+      printf("%-10s", s.name);
+      for (int t=0; t<numThreadCounts; t++) {
+        int threads = threadCounts[t];
+        double time = timeStrategy(s, threads, threads*work, data);
+        printf(" %10.3f", time * 1.e6);
+      }
+      printf("\n");
+    }
+  }
+  delete [] data;
+  return 0;
+}
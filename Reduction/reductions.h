@@ -0,0 +1,100 @@
+/*
+ * The basic float reductions from sumReduction.cxx, in a header so that the
+ * other codes here can compare against them.
+ *
+ * License: Apache License v2.0 with LLVM Exceptions.
+ * See https://llvm.org/LICENSE.txt for license information.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+#ifndef REDUCTION_REDUCTIONS_H
+#define REDUCTION_REDUCTIONS_H
+
+#include <algorithm>
+#include <cmath>
+#include <set>
+#include <omp.h>
+
+inline float parTot(int n, float const * a) {
+    float total = 0.0;
+    
+    #pragma omp parallel for reduction(+:total)
+    for (int i=0; i<n; i++)
+      total += a[i];
+
+    return total;
+}
+
+inline float parTotDA(int n, float const * a) {
+    double total = 0.0;
+    
+    #pragma omp parallel for reduction(+:total)
+    for (int i=0; i<n; i++)
+      total += a[i];
+
+    return total;
+}
+
+inline float serTot(int n, float const *a ){
+    float total = 0.0;
+    
+    for (int i=0; i<n; i++)
+      total += a[i];
+
+    return total;
+}
+
+inline float serTotDA(int n, float const * a) {
+    double total = 0.0;
+    
+    #pragma omp parallel for reduction(+:total)
+    for (int i=0; i<n; i++)
+      total += a[i];
+
+    return total;
+}
+
+// serTotDA (as in sumReduction) is actually parallel; this really is serial.
+inline float serialTotDA(int n, float const * a) {
+    double total = 0.0;
+    
+    for (int i=0; i<n; i++)
+      total += a[i];
+
+    return total;
+}
+
+template<class MT> class less {
+ public:
+  bool operator()(MT const & a, MT const & b) const {
+    return std::abs(a) < std::abs(b);
+  }
+};
+
+inline float orderedReduction(int n, float const *a) {
+  // Build the sorted container
+  std::multiset<float,less<float>> sortedValues;
+  for (int i=0; i<n; i++) {
+    sortedValues.insert(a[i]);
+  }
+
+  // Perform the sorted reduction.
+  while (sortedValues.size() != 1) {
+    float a = sortedValues.extract (sortedValues.begin()).value();
+    float b = sortedValues.extract (sortedValues.begin()).value();
+
+    // printf("%g + %g = %g\n",a,b,a+b);
+
+    sortedValues.insert(a+b);
+  }
+
+  return *sortedValues.begin();
+}
+
+inline void initArray(int n, float *a) {
+  a[0] = 1.0;
+  a[n-1] = -1.0;
+  for (int i=1; i<n-1; i++) {
+    a[i] = 2.e-8;
+  }
+}
+#endif
@@ -0,0 +1,138 @@
+/*
+ * Benchmark the shared-memory allreduce between processes against the
+ * thread-based parTot.
+ * We fork the processes ourselves, so that this runs without any launcher;
+ * a real job would just construct the shmAllreduce with its own rank.
+ *
+ * License: Apache License v2.0 with LLVM Exceptions.
+ * See https://llvm.org/LICENSE.txt for license information.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <omp.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "accurateSums.h"
+#include "distributions.h"
+#include "reductions.h"
+#include "shmAllreduce.h"
+
+enum {
+  repeats = 20,
+  latencyCalls = 1000,
+};
+
+// Best time for this rank to sum its share of the data and allreduce it,
+// and the time per allreduce of a single value.
+template<class Accumulator>
+static void runRank(char const * accName, std::string const & segment,
+                    int rank, int ranks, shmWaitMode mode, int n,
+                    float const * a) {
+  shmAllreduce<Accumulator> reducer(segment.c_str(), rank, ranks, mode);
+  int begin = (long(n) * rank) / ranks;
+  int end = (long(n) * (rank+1)) / ranks;
+  Accumulator result;
+  double best = 1.e30;
+
+  for (int r=0; r<repeats; r++) {
+    reducer.allreduce(Accumulator()); // Acts as a barrier
+    double start = omp_get_wtime();
+    Accumulator mine;
+    for (int i=begin; i<end; i++)
+      mine.add(a[i]);
+    result = reducer.allreduce(mine);
+    best = std::min(best, omp_get_wtime() - start);
+  }
+
+  Accumulator one;
+  one.add(1.0);
+  reducer.allreduce(Accumulator());
+  double start = omp_get_wtime();
+  for (int c=0; c<latencyCalls; c++)
+    reducer.allreduce(one);
+  double latency = (omp_get_wtime() - start) / latencyCalls;
+
+  if (rank == 0) {
+    printf("%-12s %-5s %12.9g %10.2f %10.3f\n", accName,
+           mode == spinWait ? "spin" : "futex", result.value(), best * 1.e6,
+           latency * 1.e6);
+  }
+}
+
+template<class Accumulator>
+static void runAccumulator(char const * accName, int ranks, shmWaitMode mode,
+                           int n, float const * a) {
+  std::string segment = "/shmAllreduce." + std::to_string(getpid());
+  shmAllreduce<Accumulator>::unlink(segment.c_str());
+  fflush(stdout);
+
+  for (int rank=1; rank<ranks; rank++) {
+    if (fork() == 0) {
+      runRank<Accumulator>(accName, segment, rank, ranks, mode, n, a);
+      exit(0);
+    }
+  }
+  runRank<Accumulator>(accName, segment, 0, ranks, mode, n, a);
+  while (wait(nullptr) > 0) {
+  }
+  shmAllreduce<Accumulator>::unlink(segment.c_str());
+}
+
+int main(int argc, char ** argv) {
+  int ranks = argc > 1 ? atoi(argv[1]) : 4;
+  int arraySize = argc > 2 ? atoi(argv[2]) : 100002;
+  char const * distName = argc > 3 ? argv[3] : "cancelling";
+  auto dist = findDistribution(distName);
+  if (!dist || ranks < 1) {
+    fprintf(stderr, "Usage: %s [processes [elements [distribution]]]\n",
+            argv[0]);
+    return 1;
+  }
+  float * data = new float[arraySize];
+  dist->init(arraySize, data, 0);
+
+  // Spin waiting is only sensible with a core for each process; if you have
+  // fewer, expect the spin results to be dreadful.
+  // Fork before we touch OpenMP, so that the children don't inherit a
+  // thread pool.
+  printf("%d processes, %d elements, %s\n", ranks, arraySize, dist->name);
+  printf("%-12s %-5s %12s %10s %10s\n", "Accumulator", "Wait", "Result",
+         "Sum (us)", "Call (us)");
+  for (shmWaitMode mode : {spinWait, futexWait}) {
+    runAccumulator<plainAccumulator<float>>("float", ranks, mode, arraySize,
+                                            data);
+    runAccumulator<plainAccumulator<double>>("double", ranks, mode, arraySize,
+                                             data);
+    runAccumulator<compensatedAccumulator>("compensated", ranks, mode,
+                                           arraySize, data);
+    runAccumulator<exactAccumulator>("reproducible", ranks, mode, arraySize,
+                                     data);
+  }
+
+  // And the same sums with threads.
+  omp_set_num_threads(ranks);
+  double best = 1.e30;
+  float total = 0.0;
+  for (int r=0; r<repeats; r++) {
+    double start = omp_get_wtime();
+    total = parTot(arraySize, data);
+    best = std::min(best, omp_get_wtime() - start);
+  }
+  printf("%-12s %-5s %12.9g %10.2f\n", "parTot", "", total, best * 1.e6);
+  best = 1.e30;
+  for (int r=0; r<repeats; r++) {
+    double start = omp_get_wtime();
+    total = parTotDA(arraySize, data);
+    best = std::min(best, omp_get_wtime() - start);
+  }
+  printf("%-12s %-5s %12.9g %10.2f\n", "parTotDA", "", total, best * 1.e6);
+  printf("%-12s %-5s %12.9g\n", "exact", "",
+         accumulateTot<exactAccumulator>(arraySize, data));
+
+  delete [] data;
+  return 0;
+}
@@ -0,0 +1,192 @@
+/*
+ * An allreduce between processes on the same node, through a POSIX shared
+ * memory segment. No MPI, no network.
+ *
+ * Each rank has its own cache-line aligned slot in the segment. We reduce up
+ * a binomial tree (at each level a rank which is a multiple of 2*stride adds
+ * in the value from rank+stride), then rank 0 publishes the result and all
+ * the others read it. Slots are tagged with the generation (call count) of
+ * the value they hold, so there is no need to reset anything between calls,
+ * and since a zero-filled segment is a valid initial state there is no
+ * initialisation race between the processes attaching to it.
+ *
+ * Waiting is either a pure spin, or a short spin followed by sleeping on a
+ * futex (Linux only), which is kinder when there are more processes than
+ * cores.
+ *
+ * The accumulator is any of those in accurateSums.h, so the same code gives
+ * float, double, compensated and (with exactAccumulator) bitwise
+ * reproducible results. The tree is fixed by the number of ranks, so even
+ * the float and double results are the same on every run with the same
+ * number of processes.
+ *
+ * License: Apache License v2.0 with LLVM Exceptions.
+ * See https://llvm.org/LICENSE.txt for license information.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+#ifndef REDUCTION_SHM_ALLREDUCE_H
+#define REDUCTION_SHM_ALLREDUCE_H
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <type_traits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#if (__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+enum shmWaitMode {
+  spinWait,
+  futexWait,
+};
+
+template<class Accumulator> class shmAllreduce {
+  static_assert(std::is_trivially_copyable<Accumulator>::value,
+                "Accumulators are copied through shared memory");
+  static_assert(std::atomic<uint32_t>::is_always_lock_free &&
+                sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+                "We need address-free atomics which we can futex on");
+
+  enum {
+    cacheLineSize = 64,
+    spinCount = 10000, // Polls before we sleep, in futex mode
+  };
+
+  // Generation number of the value in the slot, and how many processes are
+  // asleep waiting for it to change.
+  struct flag {
+    std::atomic<uint32_t> generation;
+    std::atomic<uint32_t> sleepers;
+  };
+  struct alignas(cacheLineSize) slot {
+    flag ready;
+    Accumulator value;
+  };
+
+  // Slot 0 is the result slot, ranks use the following ones.
+  slot * slots;
+  size_t segmentSize;
+  int rank;
+  int ranks;
+  uint32_t generation;
+  shmWaitMode mode;
+
+  [[noreturn]] static void fatalError(char const * what, char const * name) {
+    fflush(stdout);
+    fprintf(stderr, "shmAllreduce: %s(%s): ", what, name);
+    perror("");
+    exit(1);
+  }
+
+#if (__linux__)
+  static void futex(std::atomic<uint32_t> * word, int op, uint32_t value) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), op, value, nullptr,
+            nullptr, 0);
+  }
+#endif
+
+  void waitFor(flag & f, uint32_t wanted) {
+    for (int i=0; i<spinCount; i++) {
+      if (f.generation.load(std::memory_order_acquire) == wanted) {
+        return;
+      }
+    }
+#if (__linux__)
+    if (mode == futexWait) {
+      for (;;) {
+        uint32_t seen = f.generation.load();
+        if (seen == wanted) {
+          return;
+        }
+        // The waker stores the generation, then checks sleepers; we
+        // increment sleepers, then the kernel checks that the generation is
+        // still the one we saw before putting us to sleep, so no wakeup can
+        // be lost.
+        f.sleepers++;
+        futex(&f.generation, FUTEX_WAIT, seen);
+        f.sleepers--;
+      }
+    }
+#endif
+    while (f.generation.load(std::memory_order_acquire) != wanted) {
+    }
+  }
+
+  void post(slot & s, Accumulator const & value) {
+    s.value = value;
+    s.ready.generation.store(generation);
+#if (__linux__)
+    if (s.ready.sleepers.load() != 0) {
+      futex(&s.ready.generation, FUTEX_WAKE, INT_MAX);
+    }
+#endif
+  }
+
+ public:
+  // All ranks must use the same name and number of ranks. The segment must
+  // be a fresh one (unlink it first if a previous job may have left it
+  // behind).
+  shmAllreduce(char const * name, int myRank, int numRanks,
+               shmWaitMode waitMode = futexWait)
+      : rank(myRank), ranks(numRanks), generation(0), mode(waitMode) {
+    segmentSize = (ranks + 1) * sizeof(slot);
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0600);
+    if (fd < 0) {
+      fatalError("shm_open", name);
+    }
+    // Every rank does this; they all ask for the same size, so that's fine.
+    if (ftruncate(fd, segmentSize) != 0) {
+      fatalError("ftruncate", name);
+    }
+    void * mem = mmap(nullptr, segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      fd, 0);
+    if (mem == MAP_FAILED) {
+      fatalError("mmap", name);
+    }
+    close(fd);
+    slots = static_cast<slot *>(mem);
+  }
+  ~shmAllreduce() {
+    munmap(slots, segmentSize);
+  }
+  shmAllreduce(shmAllreduce const &) = delete;
+  shmAllreduce & operator=(shmAllreduce const &) = delete;
+
+  static void unlink(char const * name) {
+    shm_unlink(name);
+  }
+
+  // Every rank must call this the same number of times.
+  Accumulator allreduce(Accumulator const & mine) {
+    Accumulator total = mine;
+    generation++;
+
+    for (int stride=1; stride<ranks; stride *= 2) {
+      if (rank % (2*stride) != 0) {
+        // Pass our partial result to our parent, and we're done here.
+        post(slots[rank+1], total);
+        break;
+      }
+      int child = rank + stride;
+      if (child < ranks) {
+        waitFor(slots[child+1].ready, generation);
+        total += slots[child+1].value;
+      }
+    }
+
+    if (rank == 0) {
+      post(slots[0], total);
+    } else {
+      waitFor(slots[0].ready, generation);
+      total = slots[0].value;
+    }
+    return total;
+  }
+};
+#endif
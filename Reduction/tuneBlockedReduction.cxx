@@ -0,0 +1,149 @@
+/*
+ * Autotune blockedSum: time every (width, accumulators) pair with data
+ * resident in L1, in L2 and in DRAM, report the results, and write the
+ * best choices as a header which blockedReduction.h will pick up.
+ *
+ * Usage: tuneBlockedReduction [output header]
+ *   e.g. tuneBlockedReduction blockedReductionTuned.h
+ *
+ * License: Apache License v2.0 with LLVM Exceptions.
+ * See https://llvm.org/LICENSE.txt for license information.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <omp.h>
+#include <unistd.h>
+
+#include "blockedReduction.h"
+#include "distributions.h"
+
+struct candidate {
+  blocking shape;
+  float (*method)(int, float const *);
+};
+
+template<int Width, int... Accumulators>
+static void addWidth(std::vector<candidate> & candidates) {
+  (candidates.push_back({{Width, Accumulators},
+                         blockedSum<Width, Accumulators>}), ...);
+}
+
+static std::vector<candidate> allCandidates() {
+  std::vector<candidate> res;
+  addWidth<4, 1, 2, 4, 6, 8, 12, 16>(res);
+  addWidth<8, 1, 2, 4, 6, 8, 12, 16>(res);
+  addWidth<16, 1, 2, 4, 6, 8>(res);
+  return res;
+}
+
+// Cache sizes as glibc reports them, with plausible defaults if it doesn't.
+static long cacheBytes(int name, long fallback) {
+#if defined(_SC_LEVEL1_DCACHE_SIZE)
+  long size = sysconf(name);
+  return size > 0 ? size : fallback;
+#else
+  (void)name;
+  return fallback;
+#endif
+}
+
+// ns per element; best of several samples, each long enough to measure.
+static double timeCandidate(candidate const & c, int n, float const * a) {
+  enum { samples = 7 };
+  long calls = std::max(1L, (1L << 26) / n);
+  double best = 1.e30;
+  volatile float sink;
+
+  for (int s=0; s<samples; s++) {
+    double start = omp_get_wtime();
+    for (long call=0; call<calls; call++)
+      sink = c.method(n, a);
+    best = std::min(best, (omp_get_wtime() - start) / calls);
+  }
+  (void)sink;
+  return best / n * 1.e9;
+}
+
+int main(int argc, char ** argv) {
+  long l1 = cacheBytes(_SC_LEVEL1_DCACHE_SIZE, 32 * 1024);
+  long l2 = cacheBytes(_SC_LEVEL2_CACHE_SIZE, 1024 * 1024);
+  long l3 = cacheBytes(_SC_LEVEL3_CACHE_SIZE, 32 * 1024 * 1024);
+  struct {
+    char const * name;
+    long bytes;
+    blocking best;
+    double bestTime;
+  } residencies[] = {
+    {"l1", l1 / 2, defaultBlocking, 1.e30},
+    {"l2", l2 / 2, defaultBlocking, 1.e30},
+    {"dram", std::max(64L << 20, 4 * l3), defaultBlocking, 1.e30},
+  };
+
+  auto candidates = allCandidates();
+  long maxBytes = residencies[2].bytes;
+  int maxElements = maxBytes / sizeof(float);
+  float * data = new float[maxElements];
+  initUniform(maxElements, data, 1);
+
+  printf("L1 %ld bytes, L2 %ld bytes, L3 %ld bytes\n", l1, l2, l3);
+  printf("ns per element\n%-8s %6s", "Width", "Accs");
+  for (auto const & r : residencies)
+    printf(" %10s", r.name);
+  printf("\n");
+
+  for (auto const & c : candidates) {
+    printf("%-8d %6d", c.shape.width, c.shape.accumulators);
+    for (auto & r : residencies) {
+      int n = r.bytes / sizeof(float);
+      double time = timeCandidate(c, n, data);
+      printf(" %10.4f", time);
+      if (time < r.bestTime) {
+        r.bestTime = time;
+        r.best = c.shape;
+      }
+    }
+    printf("\n");
+  }
+
+  printf("\nBest:\n");
+  for (auto const & r : residencies)
+    printf("  %-5s width %2d, %2d accumulators (%.4f ns/element)\n", r.name,
+           r.best.width, r.best.accumulators, r.bestTime);
+
+  if (argc > 1) {
+    FILE * out = fopen(argv[1], "w");
+    if (!out) {
+      perror(argv[1]);
+      return 1;
+    }
+    char host[256] = "unknown";
+    gethostname(host, sizeof(host) - 1);
+    time_t now = time(nullptr);
+    char date[32];
+    strftime(date, sizeof(date), "%Y-%m-%d", localtime(&now));
+
+    fprintf(out,
+            "// Generated by tuneBlockedReduction on %s, %s.\n"
+            "// Only valid for that machine and compiler flags; rerun the\n"
+            "// tuner rather than editing this.\n"
+            "#ifndef REDUCTION_BLOCKED_REDUCTION_TUNED_H\n"
+            "#define REDUCTION_BLOCKED_REDUCTION_TUNED_H\n"
+            "namespace blockedTuned {\n"
+            "constexpr long l1Bytes = %ld;\n"
+            "constexpr long l2Bytes = %ld;\n",
+            host, date, l1, l2);
+    for (auto const & r : residencies)
+      fprintf(out, "constexpr blocking %s = {%d, %d};\n", r.name,
+              r.best.width, r.best.accumulators);
+    fprintf(out, "} // namespace blockedTuned\n#endif\n");
+    fclose(out);
+    printf("Wrote %s\n", argv[1]);
+  }
+  delete [] data;
+  return 0;
+}
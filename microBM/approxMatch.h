@@ -0,0 +1,85 @@
+/*
+ * Approximate string search: find the smallest number of edits (insertions,
+ * deletions or substitutions) needed for a pattern to occur somewhere in a
+ * line, using Myers' bit-parallel algorithm ("A fast bit-vector algorithm
+ * for approximate string matching based on dynamic programming", JACM 1999).
+ *
+ * The dynamic programming matrix has a column for each text character, and a
+ * row for each pattern character. Adjacent entries differ by -1, 0 or +1, so
+ * a whole column can be held as bit vectors of the positive and negative
+ * vertical differences, and updated for the next character with a handful
+ * of word-wide logical operations and one add. A 64 bit word therefore
+ * handles patterns of up to 64 characters, which is plenty for identifiers.
+ *
+ * License: Apache License v2.0 with LLVM Exceptions.
+ * See https://llvm.org/LICENSE.txt for license information.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+#ifndef MICROBM_APPROX_MATCH_H
+#define MICROBM_APPROX_MATCH_H
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+class myersMatcher {
+  // For each byte, which pattern positions hold it.
+  uint64_t peq[256];
+  uint64_t lastBit;
+  int length;
+
+ public:
+  enum { maxLength = 64 };
+
+  myersMatcher() : lastBit(0), length(0) {
+    std::fill(&peq[0], &peq[256], 0);
+  }
+  explicit myersMatcher(std::string const & pattern)
+      : lastBit(0), length(int(pattern.size())) {
+    if (length == 0 || length > maxLength)
+      throw std::invalid_argument("Approximate patterns must be 1 to " +
+                                  std::to_string(int(maxLength)) +
+                                  " characters long");
+    std::fill(&peq[0], &peq[256], 0);
+    for (int i = 0; i < length; i++)
+      peq[uint8_t(pattern[i])] |= uint64_t(1) << i;
+    lastBit = uint64_t(1) << (length - 1);
+  }
+
+  // The fewest edits with which the pattern occurs in [p, end), or more than
+  // maxEdits if that's the best we can do. We only stop early at an exact
+  // match; a match within maxEdits may still be improved on later in the
+  // line, and the caller reports how many edits were needed.
+  int distance(char const * p, char const * end, int maxEdits) const {
+    uint64_t pv = ~uint64_t(0);
+    uint64_t mv = 0;
+    int score = length;
+    int best = length;
+
+    for (; p < end; p++) {
+      uint64_t eq = peq[uint8_t(*p)];
+      uint64_t xv = eq | mv;
+      uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+      uint64_t ph = mv | ~(xh | pv);
+      uint64_t mh = pv & xh;
+      if (ph & lastBit)
+        score++;
+      else if (mh & lastBit)
+        score--;
+      // The match can start anywhere in the text, so the top row is all
+      // zero, and nothing is shifted in.
+      ph <<= 1;
+      mh <<= 1;
+      pv = mh | ~(xv | ph);
+      mv = ph & xv;
+      if (score < best) {
+        best = score;
+        if (best == 0)
+          break;
+      }
+    }
+    return best <= maxEdits ? best : maxEdits + 1;
+  }
+};
+#endif
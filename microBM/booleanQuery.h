@@ -0,0 +1,271 @@
+/*
+ * Boolean queries over several patterns, such as
+ *     /error/ AND NOT (/debug/ OR /trace/)
+ * Each pattern is written between slashes (use \/ for a slash in one), and
+ * they can be combined with AND, OR, NOT and parentheses. AND binds more
+ * tightly than OR.
+ *
+ * The point of a query, rather than one combined regular expression, is that
+ * we can choose the order in which to test the patterns, and stop as soon
+ * as we know the answer. Given the cost and selectivity (fraction of lines
+ * matched) of each pattern, measured on a sample of the input, and assuming
+ * that they're independent, the cheapest order for an AND is increasing
+ * cost / (1 - selectivity) (cheap patterns which usually fail first), and
+ * for an OR increasing cost / selectivity (cheap patterns which usually
+ * succeed first). We apply that bottom up, estimating the cost and
+ * selectivity of each sub-query as we go.
+ *
+ * License: Apache License v2.0 with LLVM Exceptions.
+ * See https://llvm.org/LICENSE.txt for license information.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+#ifndef MICROBM_BOOLEAN_QUERY_H
+#define MICROBM_BOOLEAN_QUERY_H
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Thrown for queries we can't parse.
+class queryError : public std::runtime_error {
+ public:
+  explicit queryError(std::string const & what) : std::runtime_error(what) {}
+};
+
+struct queryNode {
+  enum kind_t { predicate, all, any, negate } kind;
+  int index; // For predicate, which pattern.
+  std::vector<queryNode> kids;
+  // Estimates, filled in by planning.
+  double cost;
+  double selectivity;
+
+  explicit queryNode(kind_t k, int i = -1)
+      : kind(k), index(i), cost(0.0), selectivity(0.5) {}
+};
+
+class booleanQuery {
+  std::vector<std::string> patterns;
+  queryNode root;
+
+  // The parser.
+  char const * start;
+  char const * pos;
+  char const * end;
+
+  [[noreturn]] void error(char const * what) const {
+    throw queryError(std::string(what) + " at offset " +
+                     std::to_string(pos - start));
+  }
+  void skipSpace() {
+    while (pos < end && isspace(uint8_t(*pos)))
+      pos++;
+  }
+  bool atKeyword(char const * word) {
+    skipSpace();
+    size_t length = strlen(word);
+    if (size_t(end - pos) < length || strncmp(pos, word, length) != 0 ||
+        (pos + length < end && isalnum(uint8_t(pos[length]))))
+      return false;
+    pos += length;
+    return true;
+  }
+
+  queryNode parsePattern() {
+    std::string pattern;
+    for (pos++; pos < end && *pos != '/'; pos++) {
+      if (*pos == '\\' && pos + 1 < end && pos[1] == '/')
+        pos++;
+      pattern += *pos;
+    }
+    if (pos == end)
+      error("Unterminated pattern");
+    pos++;
+    if (patterns.size() == maxPredicates)
+      error("Too many patterns");
+    patterns.push_back(pattern);
+    return queryNode(queryNode::predicate, int(patterns.size()) - 1);
+  }
+  queryNode parseUnary() {
+    if (atKeyword("NOT")) {
+      queryNode node(queryNode::negate);
+      node.kids.push_back(parseUnary());
+      return node;
+    }
+    skipSpace();
+    if (pos < end && *pos == '(') {
+      pos++;
+      queryNode node = parseOr();
+      skipSpace();
+      if (pos == end || *pos != ')')
+        error("Expected )");
+      pos++;
+      return node;
+    }
+    if (pos < end && *pos == '/')
+      return parsePattern();
+    error("Expected a /pattern/, NOT or (");
+  }
+  // Parse a list of operands separated by the keyword, flattening nested
+  // operators of the same kind so that they can all be reordered together.
+  template <typename F>
+  queryNode parseList(queryNode::kind_t kind, char const * keyword,
+                      F const & operand) {
+    queryNode first = operand();
+    if (!atKeyword(keyword))
+      return first;
+    queryNode node(kind);
+    node.kids.push_back(std::move(first));
+    do {
+      queryNode next = operand();
+      if (next.kind == kind) {
+        for (auto & k : next.kids)
+          node.kids.push_back(std::move(k));
+      } else {
+        node.kids.push_back(std::move(next));
+      }
+    } while (atKeyword(keyword));
+    return node;
+  }
+  queryNode parseAnd() {
+    return parseList(queryNode::all, "AND", [this] { return parseUnary(); });
+  }
+  queryNode parseOr() {
+    return parseList(queryNode::any, "OR", [this] { return parseAnd(); });
+  }
+
+  static void plan(queryNode & node, std::vector<double> const & cost,
+                   std::vector<double> const & selectivity) {
+    double const infinity = std::numeric_limits<double>::infinity();
+    switch (node.kind) {
+    case queryNode::predicate:
+      node.cost = cost[node.index];
+      node.selectivity = selectivity[node.index];
+      return;
+    case queryNode::negate:
+      plan(node.kids[0], cost, selectivity);
+      node.cost = node.kids[0].cost;
+      node.selectivity = 1.0 - node.kids[0].selectivity;
+      return;
+    case queryNode::all:
+    case queryNode::any: {
+      bool isAll = node.kind == queryNode::all;
+      for (auto & k : node.kids)
+        plan(k, cost, selectivity);
+      // What fraction of the time does this operand let us stop?
+      auto stops = [isAll](queryNode const & k) {
+        return isAll ? 1.0 - k.selectivity : k.selectivity;
+      };
+      std::stable_sort(node.kids.begin(), node.kids.end(),
+                       [&](queryNode const & a, queryNode const & b) {
+                         double rankA = stops(a) > 0.0 ? a.cost / stops(a)
+                                                        : infinity;
+                         double rankB = stops(b) > 0.0 ? b.cost / stops(b)
+                                                        : infinity;
+                         return rankA < rankB;
+                       });
+      // We only evaluate each operand if none before it stopped us.
+      double reached = 1.0;
+      node.cost = 0.0;
+      for (auto const & k : node.kids) {
+        node.cost += reached * k.cost;
+        reached *= 1.0 - stops(k);
+      }
+      node.selectivity = isAll ? reached : 1.0 - reached;
+      return;
+    }
+    }
+  }
+
+  template <typename F>
+  static bool evaluate(queryNode const & node, F const & test) {
+    switch (node.kind) {
+    case queryNode::predicate:
+      return test(node.index);
+    case queryNode::negate:
+      return !evaluate(node.kids[0], test);
+    case queryNode::all:
+      for (auto const & k : node.kids)
+        if (!evaluate(k, test))
+          return false;
+      return true;
+    case queryNode::any:
+      for (auto const & k : node.kids)
+        if (evaluate(k, test))
+          return true;
+      return false;
+    }
+    return false;
+  }
+
+  std::string describe(queryNode const & node, bool nested) const {
+    switch (node.kind) {
+    case queryNode::predicate:
+      return written(node.index);
+    case queryNode::negate:
+      return "NOT " + describe(node.kids[0], true);
+    case queryNode::all:
+    case queryNode::any: {
+      std::string res = nested ? "(" : "";
+      for (auto const & k : node.kids) {
+        if (&k != &node.kids[0])
+          res += node.kind == queryNode::all ? " AND " : " OR ";
+        res += describe(k, true);
+      }
+      return nested ? res + ")" : res;
+    }
+    }
+    return "";
+  }
+
+ public:
+  // We keep per-pattern statistics in fixed size arrays.
+  enum { maxPredicates = 16 };
+
+  explicit booleanQuery(std::string const & text)
+      : root(queryNode::predicate), start(text.data()), pos(start),
+        end(start + text.size()) {
+    root = parseOr();
+    skipSpace();
+    if (pos != end)
+      error("Unexpected text");
+  }
+
+  int size() const { return int(patterns.size()); }
+  std::string const & pattern(int i) const { return patterns[i]; }
+  // Pattern i as it would be written in a query.
+  std::string written(int i) const {
+    std::string res = "/";
+    for (char c : patterns[i]) {
+      if (c == '/')
+        res += '\\';
+      res += c;
+    }
+    return res + "/";
+  }
+
+  // Order the operands of every AND and OR, given each pattern's cost
+  // (time to test a line) and selectivity.
+  void plan(std::vector<double> const & cost,
+            std::vector<double> const & selectivity) {
+    plan(root, cost, selectivity);
+  }
+  double estimatedCost() const { return root.cost; }
+  double estimatedSelectivity() const { return root.selectivity; }
+
+  // Evaluate the query in the planned order; test(i) says whether pattern i
+  // matches.
+  template <typename F>
+  bool evaluate(F const & test) const {
+    return evaluate(root, test);
+  }
+
+  // The query in its planned order.
+  std::string describe() const { return describe(root, false); }
+};
+#endif
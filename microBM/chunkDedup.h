@@ -0,0 +1,236 @@
+/*
+ * Support for not rescanning data we've already seen.
+ *
+ * Rotated, re-shipped and concatenated logs contain long runs of identical
+ * text, but not at the same offsets, so fixed size blocks don't line up.
+ * Instead we cut the input where a rolling "gear" hash of the preceding
+ * bytes has some chosen bits clear (content defined chunking, as in FastCDC),
+ * so the cut points move with the content, and identical runs of text are
+ * cut into identical chunks wherever they occur. We then move each cut to
+ * the end of its line, so that chunks hold whole lines and can be matched
+ * without knowing what came before them.
+ *
+ * Each chunk is identified by a 128 bit hash of its contents, and we keep
+ * the match results for each chunk we've scanned (for one pattern) in a
+ * cache file.
+ *
+ * License: Apache License v2.0 with LLVM Exceptions.
+ * See https://llvm.org/LICENSE.txt for license information.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+#ifndef MICROBM_CHUNK_DEDUP_H
+#define MICROBM_CHUNK_DEDUP_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
+
+struct chunkHash {
+  uint64_t low;
+  uint64_t high;
+
+  bool operator==(chunkHash const & other) const {
+    return low == other.low && high == other.high;
+  }
+};
+
+struct chunkHashHasher {
+  size_t operator()(chunkHash const & h) const { return h.low; }
+};
+
+// MurmurHash3 (x64, 128 bit) by Austin Appleby, which is in the public
+// domain. It isn't cryptographic, but we don't have adversaries, only
+// log files.
+inline chunkHash hashChunk(char const * data, size_t length,
+                           uint64_t seed = 0) {
+  auto rotl = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+  auto fmix = [](uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdull;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ull;
+    k ^= k >> 33;
+    return k;
+  };
+  uint64_t const c1 = 0x87c37b91114253d5ull;
+  uint64_t const c2 = 0x4cf5ad432745937full;
+  uint64_t h1 = seed;
+  uint64_t h2 = seed;
+  size_t blocks = length / 16;
+  for (size_t i = 0; i < blocks; i++) {
+    uint64_t k1, k2;
+    memcpy(&k1, data + 16 * i, 8);
+    memcpy(&k2, data + 16 * i + 8, 8);
+    k1 *= c1;
+    k1 = rotl(k1, 31);
+    k1 *= c2;
+    h1 ^= k1;
+    h1 = rotl(h1, 27);
+    h1 += h2;
+    h1 = h1 * 5 + 0x52dce729;
+    k2 *= c2;
+    k2 = rotl(k2, 33);
+    k2 *= c1;
+    h2 ^= k2;
+    h2 = rotl(h2, 31);
+    h2 += h1;
+    h2 = h2 * 5 + 0x38495ab5;
+  }
+  unsigned char const * tail =
+      reinterpret_cast<unsigned char const *>(data + 16 * blocks);
+  uint64_t k1 = 0, k2 = 0;
+  size_t rest = length & 15;
+  for (size_t i = rest; i > 8; i--)
+    k2 ^= uint64_t(tail[i - 1]) << (8 * (i - 9));
+  if (rest > 8) {
+    k2 *= c2;
+    k2 = rotl(k2, 33);
+    k2 *= c1;
+    h2 ^= k2;
+  }
+  for (size_t i = std::min<size_t>(rest, 8); i > 0; i--)
+    k1 ^= uint64_t(tail[i - 1]) << (8 * (i - 1));
+  if (rest > 0) {
+    k1 *= c1;
+    k1 = rotl(k1, 31);
+    k1 *= c2;
+    h1 ^= k1;
+  }
+  h1 ^= length;
+  h2 ^= length;
+  h1 += h2;
+  h2 += h1;
+  h1 = fmix(h1);
+  h2 = fmix(h2);
+  h1 += h2;
+  h2 += h1;
+  return {h1, h2};
+}
+
+class gearChunker {
+  uint64_t gear[256];
+  uint64_t mask;
+  size_t minSize;
+
+ public:
+  // Chunks will average about averageSize (rounded to a power of two),
+  // plus the distance to the end of the line.
+  explicit gearChunker(size_t averageSize) {
+    // Any fixed random numbers will do; these come from splitmix64.
+    uint64_t x = 0x6a09e667f3bcc908ull;
+    for (auto & g : gear) {
+      uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+      g = z ^ (z >> 31);
+    }
+    int bits = 0;
+    while ((size_t(2) << bits) <= averageSize)
+      bits++;
+    // Use the high bits of the hash, since they depend on more bytes.
+    mask = bits ? ~uint64_t(0) << (64 - bits) : 0;
+    minSize = averageSize / 4;
+  }
+
+  // Where the chunk starting at p ends.
+  char const * nextCut(char const * p, char const * end) const {
+    if (size_t(end - p) <= minSize)
+      return end;
+    char const * q = p + minSize;
+    uint64_t hash = 0;
+    for (; q < end; q++) {
+      hash = (hash << 1) + gear[uint8_t(*q)];
+      if ((hash & mask) == 0)
+        break;
+    }
+    char const * newline =
+        static_cast<char const *>(memchr(q, '\n', end - q));
+    return newline ? newline + 1 : end;
+  }
+};
+
+// The match results for a chunk.
+struct chunkResult {
+  int64_t lines;
+  int64_t matches;
+};
+
+// The results for every chunk we've scanned for one pattern, optionally
+// kept in a file.
+class chunkResultCache {
+  std::unordered_map<chunkHash, chunkResult, chunkHashHasher> results;
+  std::string path;
+  std::string key;
+  size_t loaded;
+
+  struct record {
+    chunkHash hash;
+    chunkResult result;
+  };
+
+ public:
+  chunkResultCache() : loaded(0) {}
+  // key identifies what the results are for (e.g. the pattern).
+  chunkResultCache(std::string const & cacheDir, std::string const & k)
+      : key(k), loaded(0) {
+    uint64_t hash = hashChunk(key.data(), key.size()).low;
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.chunks", (unsigned long long)hash);
+    path = cacheDir + name;
+
+    FILE * f = fopen(path.c_str(), "rb");
+    if (!f)
+      return;
+    uint32_t keyLength;
+    std::string fileKey;
+    if (fread(&keyLength, sizeof(keyLength), 1, f) == 1 &&
+        keyLength == key.size()) {
+      fileKey.resize(keyLength);
+      if (fread(&fileKey[0], 1, keyLength, f) == keyLength && fileKey == key) {
+        record r;
+        while (fread(&r, sizeof(r), 1, f) == 1)
+          results[r.hash] = r.result;
+      }
+    }
+    fclose(f);
+    loaded = results.size();
+  }
+
+  size_t size() const { return results.size(); }
+  bool find(chunkHash const & h, chunkResult * result) const {
+    auto it = results.find(h);
+    if (it == results.end())
+      return false;
+    *result = it->second;
+    return true;
+  }
+  void add(chunkHash const & h, chunkResult const & result) {
+    results[h] = result;
+  }
+
+  // Write everything out again, if we have a file and anything new.
+  void save() const {
+    if (path.empty() || results.size() == loaded)
+      return;
+    std::string temp = path + "." + std::to_string(getpid());
+    FILE * f = fopen(temp.c_str(), "wb");
+    if (!f)
+      return;
+    uint32_t keyLength = uint32_t(key.size());
+    bool ok = fwrite(&keyLength, sizeof(keyLength), 1, f) == 1 &&
+              fwrite(key.data(), 1, key.size(), f) == key.size();
+    for (auto const & r : results) {
+      record rec = {r.first, r.second};
+      ok = ok && fwrite(&rec, sizeof(rec), 1, f) == 1;
+    }
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(temp.c_str(), path.c_str()) != 0)
+      unlink(temp.c_str());
+  }
+};
+#endif
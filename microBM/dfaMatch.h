@@ -0,0 +1,894 @@
+/*
+ * A small DFA based matcher for (a useful subset of) POSIX basic regular
+ * expressions, as used by grep.
+ *
+ * Unlike std::regex, a DFA has no state other than a single integer, so we
+ * can stop in the middle of a line (at the end of a block we've read),
+ * remember that, and carry on later with the next block. That means we never
+ * need a whole line in memory, however long it is.
+ *
+ * We support literals, ., bracket expressions (with ranges and [:class:]
+ * names), *, \+, \?, \{m,n\}, \( \), \| and the anchors ^ and $. Back
+ * references can't be done with a DFA, so they're rejected.
+ *
+ * The pattern is compiled to a Thompson NFA and then eagerly (by subset
+ * construction) to a DFA whose transitions are on classes of equivalent
+ * bytes. Start of line and end of line are handled as virtual symbols which
+ * are fed in around each newline, so the DFA transition on '\n' includes
+ * them. Each DFA transition also records whether a match completed during it.
+ *
+ * There are two modes.
+ *  - lines: we only care whether a line matches, so after a match the DFA
+ *    just skips to the end of the line, and patterns can't match newlines.
+ *  - multiline: patterns can match newlines (written as \n; . and [^...]
+ *    still don't match them), so can span lines. We count matches, and after
+ *    each one start looking for the next.
+ *
+ * Building the DFA for a big pattern can take a while, so compiled DFAs can
+ * be saved to a cache directory, and mapped straight back in next time.
+ *
+ * License: Apache License v2.0 with LLVM Exceptions.
+ * See https://llvm.org/LICENSE.txt for license information.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+#ifndef MICROBM_DFA_MATCH_H
+#define MICROBM_DFA_MATCH_H
+
+#include <algorithm>
+#include <bitset>
+#include <cctype>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Thrown for patterns we can't parse, or which are too big for a DFA.
+class patternError : public std::runtime_error {
+ public:
+  explicit patternError(std::string const & what) : std::runtime_error(what) {}
+};
+
+typedef std::bitset<256> byteSet;
+
+enum class dfaMode { lines, multiline };
+
+// Parse tree for a basic regular expression.
+struct reNode {
+  enum kind_t { bytes, bol, eol, concat, alternate, repeat } kind;
+  byteSet set;
+  int min, max; // For repeat; max < 0 means unbounded.
+  std::vector<reNode> kids;
+
+  explicit reNode(kind_t k) : kind(k), min(0), max(0) {}
+};
+
+class breParser {
+  char const * start;
+  char const * pos;
+  char const * end;
+  int depth;
+  bool allowNewline;
+
+  [[noreturn]] void error(char const * what) const {
+    throw patternError(std::string(what) + " at offset " +
+                       std::to_string(pos - start));
+  }
+
+  bool atEscaped(char c) const {
+    return pos + 1 < end && pos[0] == '\\' && pos[1] == c;
+  }
+  // Is this the end of a branch?
+  bool atBranchEnd() const {
+    return pos == end || atEscaped('|') || (depth > 0 && atEscaped(')'));
+  }
+
+  static byteSet anyByte() {
+    byteSet set;
+    set.set();
+    // Lines never contain their newline.
+    set.reset('\n');
+    return set;
+  }
+
+  void addClass(byteSet & set, std::string const & name) {
+    static struct {
+      char const * name;
+      int (*test)(int);
+    } classes[] = {
+        {"alnum", isalnum}, {"alpha", isalpha}, {"blank", isblank},
+        {"cntrl", iscntrl}, {"digit", isdigit}, {"graph", isgraph},
+        {"lower", islower}, {"print", isprint}, {"punct", ispunct},
+        {"space", isspace}, {"upper", isupper}, {"xdigit", isxdigit},
+    };
+    for (auto const & c : classes) {
+      if (name == c.name) {
+        for (int b = 0; b < 128; b++) {
+          if (c.test(b))
+            set.set(b);
+        }
+        return;
+      }
+    }
+    error("Unknown character class");
+  }
+
+  // We have just consumed the '['.
+  byteSet parseBracket() {
+    byteSet set;
+    bool negate = false;
+    if (pos < end && *pos == '^') {
+      negate = true;
+      pos++;
+    }
+    bool first = true;
+    for (;;) {
+      if (pos == end)
+        error("Unterminated [");
+      unsigned char c = *pos;
+      if (c == ']' && !first) {
+        pos++;
+        break;
+      }
+      first = false;
+      if (c == '[' && pos + 1 < end && pos[1] == ':') {
+        char const * close = strstr(pos + 2, ":]");
+        if (!close || close >= end)
+          error("Unterminated [:");
+        addClass(set, std::string(pos + 2, close));
+        pos = close + 2;
+        continue;
+      }
+      if (c == '[' && pos + 1 < end && (pos[1] == '.' || pos[1] == '='))
+        error("Collating elements are not supported");
+      pos++;
+      if (pos + 1 < end && *pos == '-' && pos[1] != ']') {
+        unsigned char last = pos[1];
+        if (last < c)
+          error("Invalid range");
+        for (int b = c; b <= last; b++)
+          set.set(b);
+        pos += 2;
+      } else {
+        set.set(c);
+      }
+    }
+    if (negate) {
+      set.flip();
+      set.reset('\n');
+    }
+    return set;
+  }
+
+  int parseNumber() {
+    if (pos == end || !isdigit((unsigned char)*pos))
+      error("Expected a number in \\{\\}");
+    int value = 0;
+    while (pos < end && isdigit((unsigned char)*pos)) {
+      value = value * 10 + (*pos++ - '0');
+      if (value > 255)
+        error("Repeat count too large");
+    }
+    return value;
+  }
+
+  reNode parseAtom() {
+    unsigned char c = *pos;
+    if (c == '[') {
+      pos++;
+      reNode node(reNode::bytes);
+      node.set = parseBracket();
+      return node;
+    }
+    if (c == '.') {
+      pos++;
+      reNode node(reNode::bytes);
+      node.set = anyByte();
+      return node;
+    }
+    if (c == '\\') {
+      if (pos + 1 == end)
+        error("Trailing \\");
+      c = pos[1];
+      pos += 2;
+      if (c == '(') {
+        depth++;
+        reNode node = parseAlternation();
+        depth--;
+        if (!atEscaped(')'))
+          error("Unmatched \\(");
+        pos += 2;
+        return node;
+      }
+      if (c >= '1' && c <= '9')
+        error("Back references are not supported");
+      if (c == '{' || c == '}' || c == ')')
+        error("Unexpected escape");
+      reNode node(reNode::bytes);
+      if (c == 'n') {
+        if (!allowNewline)
+          error("\\n can only be used in multiline mode");
+        c = '\n';
+      }
+      node.set.set(c);
+      return node;
+    }
+    pos++;
+    reNode node(reNode::bytes);
+    node.set.set(c);
+    return node;
+  }
+
+  // Wrap the node in any repetition operators which follow it.
+  reNode parseRepeats(reNode atom) {
+    for (;;) {
+      int min, max;
+      if (pos < end && *pos == '*') {
+        pos++;
+        min = 0;
+        max = -1;
+      } else if (atEscaped('+')) {
+        pos += 2;
+        min = 1;
+        max = -1;
+      } else if (atEscaped('?')) {
+        pos += 2;
+        min = 0;
+        max = 1;
+      } else if (atEscaped('{')) {
+        pos += 2;
+        min = parseNumber();
+        max = min;
+        if (pos < end && *pos == ',') {
+          pos++;
+          max = (pos < end && *pos != '\\') ? parseNumber() : -1;
+        }
+        if (!atEscaped('}'))
+          error("Unterminated \\{");
+        pos += 2;
+        if (max >= 0 && max < min)
+          error("Invalid repeat range");
+      } else {
+        return atom;
+      }
+      reNode node(reNode::repeat);
+      node.min = min;
+      node.max = max;
+      node.kids.push_back(std::move(atom));
+      atom = std::move(node);
+    }
+  }
+
+  reNode parseBranch() {
+    reNode branch(reNode::concat);
+    // A leading ^ is an anchor, and a * after it (or at the start) is literal.
+    if (pos < end && *pos == '^') {
+      pos++;
+      branch.kids.push_back(reNode(reNode::bol));
+    }
+    if (pos < end && *pos == '*') {
+      pos++;
+      reNode star(reNode::bytes);
+      star.set.set('*');
+      branch.kids.push_back(parseRepeats(std::move(star)));
+    }
+    while (!atBranchEnd()) {
+      // $ is only an anchor at the end of a branch.
+      if (*pos == '$') {
+        pos++;
+        if (atBranchEnd()) {
+          branch.kids.push_back(reNode(reNode::eol));
+        } else {
+          reNode dollar(reNode::bytes);
+          dollar.set.set('$');
+          branch.kids.push_back(parseRepeats(std::move(dollar)));
+        }
+        continue;
+      }
+      branch.kids.push_back(parseRepeats(parseAtom()));
+    }
+    return branch;
+  }
+
+  reNode parseAlternation() {
+    reNode alt(reNode::alternate);
+    alt.kids.push_back(parseBranch());
+    while (atEscaped('|')) {
+      pos += 2;
+      alt.kids.push_back(parseBranch());
+    }
+    return alt;
+  }
+
+ public:
+  breParser(std::string const & pattern, bool newlines)
+      : start(pattern.data()), pos(start), end(start + pattern.size()),
+        depth(0), allowNewline(newlines) {}
+
+  reNode parse() {
+    reNode res = parseAlternation();
+    if (pos != end)
+      error("Unmatched \\)");
+    return res;
+  }
+};
+
+// A Thompson NFA.
+struct nfaState {
+  enum kind_t { bytes, bol, eol, split, accept } kind;
+  byteSet set;
+  int out;
+  int out1; // Only for split; < 0 if it's a simple epsilon.
+};
+
+class nfa {
+  std::vector<nfaState> states;
+  int startState;
+
+  int add(nfaState::kind_t kind, int out, int out1 = -1) {
+    states.push_back({kind, byteSet(), out, out1});
+    return int(states.size()) - 1;
+  }
+
+  // Build the states for node so that they lead on to next, and return the
+  // entry state. Working backwards like this avoids needing to patch lists
+  // of dangling exits.
+  int build(reNode const & node, int next) {
+    switch (node.kind) {
+    case reNode::bytes: {
+      int s = add(nfaState::bytes, next);
+      states[s].set = node.set;
+      return s;
+    }
+    case reNode::bol:
+      return add(nfaState::bol, next);
+    case reNode::eol:
+      return add(nfaState::eol, next);
+    case reNode::concat:
+      for (auto k = node.kids.rbegin(); k != node.kids.rend(); ++k)
+        next = build(*k, next);
+      return next;
+    case reNode::alternate: {
+      int entry = build(node.kids.back(), next);
+      for (int k = int(node.kids.size()) - 2; k >= 0; k--)
+        entry = add(nfaState::split, build(node.kids[k], next), entry);
+      return entry;
+    }
+    case reNode::repeat: {
+      reNode const & kid = node.kids[0];
+      int entry = next;
+      if (node.max < 0) {
+        // A loop, which we can leave each time round.
+        int loop = add(nfaState::split, -1, next);
+        states[loop].out = build(kid, loop);
+        entry = loop;
+      } else {
+        for (int i = node.min; i < node.max; i++)
+          entry = add(nfaState::split, build(kid, entry), next);
+      }
+      for (int i = 0; i < node.min; i++)
+        entry = build(kid, entry);
+      return entry;
+    }
+    }
+    return next;
+  }
+
+ public:
+  explicit nfa(reNode const & root) {
+    int accept = add(nfaState::accept, -1);
+    startState = build(root, accept);
+  }
+  int size() const { return int(states.size()); }
+  int start() const { return startState; }
+  nfaState const & operator[](int s) const { return states[s]; }
+};
+
+class dfaMatcher {
+  // A set of NFA states. Split states are never included; we follow them
+  // when computing the closure. Two pseudo-states are also used:
+  // pendingBOL says that we're at the start of a line but haven't yet
+  // fed in the start of line symbol, and skipLine is the state we sit in
+  // after a match until the end of the line (in lines mode).
+  typedef std::vector<int> stateSet;
+
+  // Change this whenever what we build changes, so that old cached DFAs
+  // aren't used.
+  enum { engineVersion = 1 };
+
+  // How we're laid out in a cache file; the key (the pattern and mode),
+  // then the transition table and the end of input matches follow this.
+  struct fileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t numClasses;
+    uint32_t numStates;
+    uint32_t initialState;
+    uint32_t keyLength;
+    uint8_t classOf[256];
+  };
+
+  int numClasses;
+  int initialState;
+  int stateCount;
+  uint8_t classOf[256];
+  // The tables are either in memory we allocated or in a mapped cache file;
+  // either way, this keeps them alive.
+  std::shared_ptr<void const> storage;
+  // stateCount x numClasses entries, each (next state << 1) | matched.
+  uint32_t const * table;
+  uint8_t const * endMatches;
+
+  dfaMatcher() : numClasses(0), initialState(0), stateCount(0),
+                 table(nullptr), endMatches(nullptr) {}
+
+  // The pieces we only need while building the DFA.
+  struct builder {
+    nfa const & n;
+    dfaMode mode;
+    int pendingBOL;
+    int skipLine;
+    stateSet startClosure;
+
+    builder(nfa const & automaton, dfaMode m)
+        : n(automaton), mode(m), pendingBOL(automaton.size()),
+          skipLine(automaton.size() + 1) {
+      addClosure(startClosure, n.start());
+      normalise(startClosure);
+    }
+
+    void addClosure(stateSet & set, int s) const {
+      std::vector<bool> seen(n.size());
+      std::vector<int> stack = {s};
+      while (!stack.empty()) {
+        int t = stack.back();
+        stack.pop_back();
+        if (t < 0 || seen[t])
+          continue;
+        seen[t] = true;
+        if (n[t].kind == nfaState::split) {
+          stack.push_back(n[t].out1);
+          stack.push_back(n[t].out);
+        } else {
+          set.push_back(t);
+        }
+      }
+    }
+    static void normalise(stateSet & set) {
+      std::sort(set.begin(), set.end());
+      set.erase(std::unique(set.begin(), set.end()), set.end());
+    }
+    bool accepts(stateSet const & set) const {
+      for (int s : set) {
+        if (s < n.size() && n[s].kind == nfaState::accept)
+          return true;
+      }
+      return false;
+    }
+    // Start and end of line are assertions, so states which aren't waiting
+    // for this one are unaffected by it.
+    stateSet stepVirtual(stateSet const & set,
+                         nfaState::kind_t symbol) const {
+      stateSet res;
+      for (int s : set) {
+        if (s >= n.size())
+          continue;
+        if (n[s].kind == symbol)
+          addClosure(res, n[s].out);
+        else
+          res.push_back(s);
+      }
+      normalise(res);
+      return res;
+    }
+    // Since we're searching, a match can start at any byte, so the start
+    // state is always live.
+    stateSet stepByte(stateSet const & set, unsigned char byte) const {
+      stateSet res = startClosure;
+      for (int s : set) {
+        if (s < n.size() && n[s].kind == nfaState::bytes && n[s].set[byte])
+          addClosure(res, n[s].out);
+      }
+      normalise(res);
+      return res;
+    }
+    stateSet lineStart() const {
+      stateSet res = startClosure;
+      res.push_back(pendingBOL);
+      return res;
+    }
+    bool isPendingBOL(stateSet const & set) const {
+      return !set.empty() && set.back() == pendingBOL;
+    }
+
+    // Feed a byte (with the virtual symbols which go with it).
+    stateSet transition(stateSet const & from, unsigned char byte,
+                        bool * matched) const {
+      return mode == dfaMode::lines ? lineTransition(from, byte, matched)
+                                    : multilineTransition(from, byte, matched);
+    }
+
+    stateSet lineTransition(stateSet const & from, unsigned char byte,
+                            bool * matched) const {
+      *matched = false;
+      if (from.size() == 1 && from[0] == skipLine)
+        return byte == '\n' ? lineStart() : from;
+
+      stateSet set = from;
+      if (isPendingBOL(set)) {
+        set = stepVirtual(set, nfaState::bol);
+        *matched = *matched || accepts(set);
+      }
+      if (byte == '\n') {
+        set = stepVirtual(set, nfaState::eol);
+        *matched = *matched || accepts(set);
+        return lineStart();
+      }
+      if (*matched)
+        return stateSet{skipLine};
+      set = stepByte(set, byte);
+      *matched = accepts(set);
+      return *matched ? stateSet{skipLine} : set;
+    }
+
+    // After a match we start again from where it ended, so matches don't
+    // overlap. (If two matches end within one transition we only count one,
+    // which can only happen with patterns which match around a newline.)
+    stateSet multilineTransition(stateSet const & from, unsigned char byte,
+                                 bool * matched) const {
+      *matched = false;
+      stateSet set = from;
+      auto check = [&]() {
+        if (accepts(set)) {
+          *matched = true;
+          set = startClosure;
+        }
+      };
+      if (isPendingBOL(set)) {
+        set = stepVirtual(set, nfaState::bol);
+        check();
+      }
+      if (byte == '\n') {
+        set = stepVirtual(set, nfaState::eol);
+        check();
+      }
+      set = stepByte(set, byte);
+      check();
+      if (byte == '\n')
+        set.push_back(pendingBOL);
+      return set;
+    }
+
+    // Would we match if the input ended here, without a final newline?
+    bool matchesAtEnd(stateSet const & from) const {
+      if (from.size() == 1 && from[0] == skipLine)
+        return false;
+      stateSet set = from;
+      if (isPendingBOL(set)) {
+        set = stepVirtual(set, nfaState::bol);
+        if (accepts(set))
+          return true;
+      }
+      return accepts(stepVirtual(set, nfaState::eol));
+    }
+  };
+
+  // Bytes are equivalent if every NFA byte set either contains both of
+  // them or neither. Newline always has its own class.
+  void computeClasses(nfa const & n) {
+    std::map<std::vector<bool>, int> signatures;
+    for (int b = 0; b < 256; b++) {
+      std::vector<bool> signature;
+      signature.push_back(b == '\n');
+      for (int s = 0; s < n.size(); s++) {
+        if (n[s].kind == nfaState::bytes)
+          signature.push_back(n[s].set[b]);
+      }
+      auto it = signatures.emplace(signature, int(signatures.size())).first;
+      classOf[b] = uint8_t(it->second);
+    }
+    numClasses = int(signatures.size());
+  }
+
+  void build(nfa const & n, dfaMode mode, int maxStates) {
+    computeClasses(n);
+    std::vector<int> representative(numClasses);
+    for (int b = 255; b >= 0; b--)
+      representative[classOf[b]] = b;
+
+    builder b(n, mode);
+    std::map<stateSet, int> ids;
+    std::vector<stateSet> sets;
+    auto intern = [&](stateSet const & set) {
+      auto it = ids.find(set);
+      if (it != ids.end())
+        return it->second;
+      if (int(sets.size()) >= maxStates)
+        throw patternError("Pattern needs more than " +
+                           std::to_string(maxStates) + " DFA states");
+      ids.emplace(set, int(sets.size()));
+      sets.push_back(set);
+      return int(sets.size()) - 1;
+    };
+
+    std::vector<uint32_t> transitions;
+    std::vector<uint8_t> ends;
+    initialState = intern(b.lineStart());
+    for (size_t s = 0; s < sets.size(); s++) {
+      for (int c = 0; c < numClasses; c++) {
+        bool matched;
+        int next = intern(b.transition(sets[s], representative[c], &matched));
+        transitions.push_back((uint32_t(next) << 1) | (matched ? 1 : 0));
+      }
+      ends.push_back(b.matchesAtEnd(sets[s]));
+    }
+
+    stateCount = int(sets.size());
+    auto tables = std::make_shared<std::vector<uint32_t>>(transitions);
+    tables->insert(tables->end(), (ends.size() + 3) / 4, 0);
+    memcpy(tables->data() + transitions.size(), ends.data(), ends.size());
+    table = tables->data();
+    endMatches = reinterpret_cast<uint8_t const *>(table + transitions.size());
+    storage = tables;
+  }
+
+  static std::string cacheKey(std::string const & pattern, dfaMode mode) {
+    return std::string(mode == dfaMode::lines ? "lines:" : "multiline:") +
+           pattern;
+  }
+  size_t tableBytes() const {
+    return size_t(stateCount) * numClasses * sizeof(uint32_t) + stateCount;
+  }
+  static size_t roundUp4(size_t n) { return (n + 3) & ~size_t(3); }
+
+  // Returns false if the file doesn't exist, isn't for this key, or isn't
+  // a DFA we could safely run (it may be truncated or corrupt, and scan()
+  // doesn't check anything).
+  bool load(std::string const & path, std::string const & key) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat info;
+    void * map = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && size_t(info.st_size) > sizeof(fileHeader))
+      map = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+      return false;
+    size_t length = info.st_size;
+    storage = std::shared_ptr<void const>(
+        map, [length](void const * p) { munmap(const_cast<void *>(p), length); });
+
+    auto header = static_cast<fileHeader const *>(map);
+    char const * keyStart = reinterpret_cast<char const *>(header + 1);
+    if (memcmp(header->magic, "omp_scan", 8) != 0 ||
+        header->version != engineVersion || header->keyLength != key.size() ||
+        sizeof(fileHeader) + roundUp4(key.size()) > length ||
+        memcmp(keyStart, key.data(), key.size()) != 0)
+      return false;
+    // scan() indexes the table with an int, so it must fit.
+    if (header->numClasses < 1 || header->numClasses > 256 ||
+        header->numStates < 1 ||
+        header->numStates > uint32_t(INT_MAX) / header->numClasses ||
+        header->initialState >= header->numStates)
+      return false;
+    numClasses = header->numClasses;
+    stateCount = header->numStates;
+    initialState = header->initialState;
+    memcpy(classOf, header->classOf, sizeof(classOf));
+    if (sizeof(fileHeader) + roundUp4(key.size()) + tableBytes() != length)
+      return false;
+    for (int b = 0; b < 256; b++)
+      if (classOf[b] >= numClasses)
+        return false;
+    table = reinterpret_cast<uint32_t const *>(keyStart + roundUp4(key.size()));
+    endMatches = reinterpret_cast<uint8_t const *>(
+        table + size_t(stateCount) * numClasses);
+    size_t entries = size_t(stateCount) * numClasses;
+    for (size_t i = 0; i < entries; i++)
+      if ((table[i] >> 1) >= uint32_t(stateCount))
+        return false;
+    return true;
+  }
+
+  // Write to a temporary file and rename it, so that anyone else using the
+  // cache at the same time never sees a partial file.
+  void save(std::string const & path, std::string const & key) const {
+    fileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "omp_scan", 8);
+    header.version = engineVersion;
+    header.numClasses = numClasses;
+    header.numStates = stateCount;
+    header.initialState = initialState;
+    header.keyLength = uint32_t(key.size());
+    memcpy(header.classOf, classOf, sizeof(classOf));
+
+    std::string temp = path + "." + std::to_string(getpid());
+    FILE * f = fopen(temp.c_str(), "wb");
+    if (!f)
+      return;
+    static char const zeros[4] = {};
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+              fwrite(key.data(), 1, key.size(), f) == key.size() &&
+              fwrite(zeros, 1, roundUp4(key.size()) - key.size(), f) ==
+                  roundUp4(key.size()) - key.size() &&
+              fwrite(table, 1, tableBytes(), f) == tableBytes();
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(temp.c_str(), path.c_str()) != 0)
+      unlink(temp.c_str());
+  }
+
+ public:
+  enum { defaultMaxStates = 10000 };
+
+  explicit dfaMatcher(std::string const & pattern,
+                      dfaMode mode = dfaMode::lines,
+                      int maxStates = defaultMaxStates) {
+    build(nfa(breParser(pattern, mode == dfaMode::multiline).parse()), mode,
+          maxStates);
+  }
+
+  // Use the cache directory if we can, compiling and adding to it if the
+  // pattern isn't already there. Cache problems aren't fatal; we just
+  // compile the pattern.
+  static dfaMatcher cached(std::string const & pattern, dfaMode mode,
+                           std::string const & cacheDir) {
+    if (cacheDir.empty())
+      return dfaMatcher(pattern, mode);
+
+    std::string key = cacheKey(pattern, mode);
+    // FNV-1a; the file holds the whole key, so collisions just miss.
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (unsigned char c : key)
+      hash = (hash ^ c) * 0x100000001b3ull;
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.dfa", (unsigned long long)hash);
+    std::string path = cacheDir + name;
+
+    dfaMatcher res;
+    if (res.load(path, key))
+      return res;
+    res = dfaMatcher(pattern, mode);
+    mkdir(cacheDir.c_str(), 0777);
+    res.save(path, key);
+    return res;
+  }
+
+  int initial() const { return initialState; }
+  int numStates() const { return stateCount; }
+  static int version() { return engineVersion; }
+
+  // The states we can be in just after a newline; if we start scanning just
+  // after one, we must be in one of these. (In lines mode there is only
+  // one, since each line starts afresh.)
+  std::vector<int> newlineTargets() const {
+    std::vector<int> res = {initialState};
+    uint8_t newlineClass = classOf[uint8_t('\n')];
+    for (int s = 0; s < numStates(); s++)
+      res.push_back(table[s * numClasses + newlineClass] >> 1);
+    std::sort(res.begin(), res.end());
+    res.erase(std::unique(res.begin(), res.end()), res.end());
+    return res;
+  }
+
+  // Run from state over [p, end), counting newlines and matches (which in
+  // lines mode are matching lines).
+  // Returns the state we end in, which can be passed to a later call to
+  // continue with the following bytes.
+  int scan(int state, char const * p, char const * end, long * lines,
+           long * matches) const {
+    uint32_t const * t = table;
+    uint8_t newlineClass = classOf[uint8_t('\n')];
+    long l = 0, m = 0;
+    for (; p < end; p++) {
+      uint8_t c = classOf[uint8_t(*p)];
+      uint32_t e = t[state * numClasses + c];
+      l += c == newlineClass;
+      m += e & 1;
+      state = e >> 1;
+    }
+    *lines += l;
+    *matches += m;
+    return state;
+  }
+
+  // If the input ends in state without a final newline, is there a match
+  // at the end?
+  bool matchesAtEnd(int state) const { return endMatches[state]; }
+};
+
+// The result of scanning a piece of the input from each of several possible
+// start states, for when we don't yet know which we'll really be in.
+struct speculativeScan {
+  std::vector<int> starts;
+  std::vector<int> endState;
+  std::vector<long> matches;
+  long lines;
+
+  // Which entry is for this start state? -1 if it wasn't one we tried.
+  int find(int state) const {
+    auto it = std::lower_bound(starts.begin(), starts.end(), state);
+    return (it != starts.end() && *it == state) ? int(it - starts.begin())
+                                                : -1;
+  }
+};
+
+// Run the DFA over [p, end) from each of starts (which must be sorted).
+// Runs from different starts usually reach the same state after a few
+// bytes, after which they will always agree, so we only keep one run (a
+// "lane") going for each distinct state, and remember how the matches
+// counted by the runs which were merged into it differed from its own.
+inline speculativeScan speculate(dfaMatcher const & dfa,
+                                 std::vector<int> const & starts,
+                                 char const * p, char const * end) {
+  int numStarts = int(starts.size());
+  std::vector<int> laneState = starts;
+  std::vector<long> laneMatches(numStarts, 0);
+  std::vector<int> laneOf(numStarts);
+  std::vector<long> offset(numStarts, 0);
+  for (int i = 0; i < numStarts; i++)
+    laneOf[i] = i;
+
+  enum { maxPiece = 4096 };
+  speculativeScan res;
+  res.starts = starts;
+  res.lines = 0;
+  while (p < end) {
+    // Run to the next newline (where lanes are most likely to converge),
+    // or a page, whichever comes first.
+    char const * pieceEnd = p + std::min<long>(end - p, maxPiece);
+    char const * newline = static_cast<char const *>(
+        memchr(p, '\n', pieceEnd - p));
+    if (newline)
+      pieceEnd = newline + 1;
+    long ignoredLines = 0;
+    for (size_t l = 0; l < laneState.size(); l++) {
+      laneState[l] = dfa.scan(laneState[l], p, pieceEnd,
+                              l == 0 ? &res.lines : &ignoredLines,
+                              &laneMatches[l]);
+    }
+    p = pieceEnd;
+    if (laneState.size() == 1)
+      continue;
+
+    // Merge lanes which have reached the same state.
+    std::map<int, int> laneWithState;
+    std::vector<int> newLane(laneState.size());
+    std::vector<long> oldMatches = laneMatches;
+    size_t kept = 0;
+    for (size_t l = 0; l < laneState.size(); l++) {
+      auto it = laneWithState.emplace(laneState[l], int(kept));
+      if (it.second) {
+        laneState[kept] = laneState[l];
+        laneMatches[kept] = oldMatches[l];
+        kept++;
+      }
+      newLane[l] = it.first->second;
+    }
+    if (kept == laneState.size())
+      continue;
+    for (int i = 0; i < numStarts; i++) {
+      int lane = newLane[laneOf[i]];
+      offset[i] += oldMatches[laneOf[i]] - laneMatches[lane];
+      laneOf[i] = lane;
+    }
+    laneState.resize(kept);
+    laneMatches.resize(kept);
+  }
+
+  for (int i = 0; i < numStarts; i++) {
+    res.endState.push_back(laneState[laneOf[i]]);
+    res.matches.push_back(offset[i] + laneMatches[laneOf[i]]);
+  }
+  return res;
+}
+#endif
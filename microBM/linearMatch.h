@@ -0,0 +1,229 @@
+/*
+ * A matcher which is guaranteed to take time linear in the length of the
+ * line, and a way of telling which patterns need it.
+ *
+ * std::regex (at least in libstdc++) is a backtracking matcher, so patterns
+ * such as \(a*\)*b can take time exponential in the length of a line, and
+ * even innocent ones like a.*e.*i take time polynomial in it, since each .*
+ * is retried at every length, and the whole thing at every start position.
+ * (It also recurses as it goes, so a long enough line overflows the stack.)
+ *
+ * Instead we can simulate the Thompson NFA which the DFA is built from,
+ * keeping the set of states we could be in, and advancing them all a byte
+ * at a time (Thompson, "Regular expression search algorithm", CACM 1968;
+ * see also Russ Cox's "Regular Expression Matching Can Be Simple And
+ * Fast"). That takes O(line length * pattern size) whatever the pattern.
+ * We only need to know whether a line matches, not where, so we don't need
+ * the submatch tracking of a Pike VM.
+ *
+ * License: Apache License v2.0 with LLVM Exceptions.
+ * See https://llvm.org/LICENSE.txt for license information.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+#ifndef MICROBM_LINEAR_MATCH_H
+#define MICROBM_LINEAR_MATCH_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "dfaMatch.h"
+
+// How badly a backtracking matcher can do with a pattern.
+//  - exponential: some part of the pattern can match the same text in
+//    exponentially many ways, e.g. a variable width repeat inside an
+//    unbounded one (\(a*\)*), or a repeated alternation whose branches can
+//    start with the same byte (\(a\|ab\)*).
+//  - degree: otherwise, a line of n bytes can take O(n^degree) steps; one
+//    for the start positions, and one for each variable width repeat.
+struct backtrackRisk {
+  bool exponential;
+  int degree;
+
+ private:
+  static bool nullable(reNode const & node) {
+    switch (node.kind) {
+    case reNode::bytes:
+      return false;
+    case reNode::bol:
+    case reNode::eol:
+      return true;
+    case reNode::concat:
+      return std::all_of(node.kids.begin(), node.kids.end(), nullable);
+    case reNode::alternate:
+      return std::any_of(node.kids.begin(), node.kids.end(), nullable);
+    case reNode::repeat:
+      return node.min == 0 || nullable(node.kids[0]);
+    }
+    return false;
+  }
+
+  // The bytes a match of node can start with.
+  static byteSet firstBytes(reNode const & node) {
+    byteSet res;
+    switch (node.kind) {
+    case reNode::bytes:
+      return node.set;
+    case reNode::bol:
+    case reNode::eol:
+      return res;
+    case reNode::concat:
+      for (auto const & k : node.kids) {
+        res |= firstBytes(k);
+        if (!nullable(k))
+          break;
+      }
+      return res;
+    case reNode::alternate:
+      for (auto const & k : node.kids)
+        res |= firstBytes(k);
+      return res;
+    case reNode::repeat:
+      return firstBytes(node.kids[0]);
+    }
+    return res;
+  }
+
+  // Can node match texts of different lengths?
+  static bool variableWidth(reNode const & node) {
+    switch (node.kind) {
+    case reNode::bytes:
+    case reNode::bol:
+    case reNode::eol:
+      return false;
+    case reNode::concat:
+      return std::any_of(node.kids.begin(), node.kids.end(), variableWidth);
+    case reNode::alternate:
+      // Near enough; we'd have to compare the branches' widths.
+      return node.kids.size() > 1 || variableWidth(node.kids[0]);
+    case reNode::repeat:
+      return node.min != node.max || variableWidth(node.kids[0]);
+    }
+    return false;
+  }
+
+  static bool overlappingBranches(reNode const & node) {
+    if (node.kind != reNode::alternate)
+      return false;
+    byteSet seen;
+    for (auto const & k : node.kids) {
+      byteSet first = firstBytes(k);
+      if ((seen & first).any() || nullable(k))
+        return true;
+      seen |= first;
+    }
+    return false;
+  }
+
+  void analyse(reNode const & node, bool inLoop) {
+    bool loop = node.kind == reNode::repeat && node.max != node.min;
+    if (loop) {
+      reNode const & kid = node.kids[0];
+      if (inLoop && variableWidth(node))
+        exponential = true;
+      if (node.max < 0 && overlappingBranches(kid))
+        exponential = true;
+      if (!inLoop)
+        degree++;
+    }
+    for (auto const & k : node.kids)
+      analyse(k, inLoop || (loop && node.max < 0));
+  }
+
+ public:
+  explicit backtrackRisk(reNode const & root) : exponential(false), degree(1) {
+    analyse(root, false);
+  }
+
+  // The longest line whose worst case fits in budget steps.
+  size_t longestLine(size_t budget) const {
+    if (exponential)
+      return 0;
+    double length = std::pow(double(budget), 1.0 / degree);
+    if (length >= double(std::numeric_limits<size_t>::max()))
+      return std::numeric_limits<size_t>::max();
+    return size_t(length);
+  }
+};
+
+class linearMatcher {
+  nfa program;
+
+  // Scratch space for search. Each list is marked with a new generation
+  // number, so that we add each state to it at most once, and never have
+  // to clear the marks.
+  struct scratch {
+    std::vector<int> current;
+    std::vector<int> next;
+    std::vector<uint32_t> mark;
+    uint32_t generation = 0;
+  };
+
+  // Add state s, and everything we can reach from it without consuming a
+  // byte, to list. Returns true if that reaches the accept state.
+  bool add(scratch & work, std::vector<int> & list, int s, bool atStart,
+           bool atEnd) const {
+    if (work.mark[s] == work.generation)
+      return false;
+    work.mark[s] = work.generation;
+    nfaState const & state = program[s];
+    switch (state.kind) {
+    case nfaState::bytes:
+      list.push_back(s);
+      return false;
+    case nfaState::bol:
+      return atStart && add(work, list, state.out, atStart, atEnd);
+    case nfaState::eol:
+      return atEnd && add(work, list, state.out, atStart, atEnd);
+    case nfaState::split:
+      return add(work, list, state.out, atStart, atEnd) ||
+             (state.out1 >= 0 && add(work, list, state.out1, atStart, atEnd));
+    case nfaState::accept:
+      return true;
+    }
+    return false;
+  }
+
+  static void newGeneration(scratch & work) {
+    if (++work.generation == 0) {
+      std::fill(work.mark.begin(), work.mark.end(), 0);
+      work.generation = 1;
+    }
+  }
+
+ public:
+  explicit linearMatcher(std::string const & pattern)
+      : program(breParser(pattern, false).parse()) {}
+
+  // Does the pattern occur in the line [p, end)?
+  bool search(char const * p, char const * end) const {
+    static thread_local scratch work;
+    if (work.mark.size() < size_t(program.size()))
+      work.mark.resize(program.size(), 0);
+    work.current.clear();
+
+    newGeneration(work);
+    if (add(work, work.current, program.start(), true, p == end))
+      return true;
+    for (char const * q = p; q < end; q++) {
+      uint8_t c = uint8_t(*q);
+      bool atEnd = q + 1 == end;
+      work.next.clear();
+      newGeneration(work);
+      for (int s : work.current) {
+        nfaState const & state = program[s];
+        if (state.set[c] && add(work, work.next, state.out, false, atEnd))
+          return true;
+      }
+      // The match can also start after this byte.
+      if (add(work, work.next, program.start(), false, atEnd))
+        return true;
+      std::swap(work.current, work.next);
+    }
+    return false;
+  }
+};
+#endif
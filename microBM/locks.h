@@ -0,0 +1,249 @@
+/*
+ * A collection of lock algorithms, so that we can see how much the choice
+ * matters for a heavily contended lock (such as the one around reading a
+ * line), rather than accepting whatever an OpenMP critical section uses.
+ *
+ *  - tasLock: test-and-set; every waiter hammers the line with exchanges.
+ *  - ttasLock: test-and-test-and-set; waiters spin reading their cached
+ *    copy, and back off exponentially after failing to take the lock.
+ *  - ticketLock: take a ticket and wait for it to be served; fair (FIFO),
+ *    but every waiter still spins on the same line.
+ *  - mcsLock: Mellor-Crummey and Scott's queue lock; each waiter spins on
+ *    its own queue node, and the holder hands over directly to the next.
+ *  - clhLock: Craig, Landin and Hagersten's queue lock; each waiter spins
+ *    on its predecessor's node, which it then inherits.
+ *  - futexLock: Drepper's three state mutex ("Futexes Are Tricky"), which
+ *    sleeps in the kernel rather than spinning when it's contended.
+ *  - ompLock: an omp_lock_t, for comparison.
+ *
+ * They all have lock() and unlock(). The queue locks keep their per-thread
+ * nodes in thread_local variables, so a thread can only hold one lock of
+ * each of those types at a time, which is all we need.
+ *
+ * These spin (apart from futexLock and perhaps ompLock), so they're only
+ * sensible with no more threads than cores.
+ *
+ * License: Apache License v2.0 with LLVM Exceptions.
+ * See https://llvm.org/LICENSE.txt for license information.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+#ifndef MICROBM_LOCKS_H
+#define MICROBM_LOCKS_H
+
+#include <atomic>
+#include <cstdint>
+#include <linux/futex.h>
+#include <omp.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+// Spin politely. After a while we give up the CPU, since with more threads
+// than cores the thread we're waiting for may not be running, and spinning
+// for the rest of our time slice won't help it.
+class spinner {
+  int count;
+
+ public:
+  spinner() : count(0) {}
+  void spin() {
+    if (++count < 1000) {
+      cpuRelax();
+    } else {
+      count = 0;
+      sched_yield();
+    }
+  }
+};
+
+// Keep each lock's hot data on its own cache line.
+#define LOCK_ALIGN alignas(64)
+
+class LOCK_ALIGN tasLock {
+  std::atomic<bool> locked;
+
+ public:
+  tasLock() : locked(false) {}
+  void lock() {
+    spinner s;
+    while (locked.exchange(true, std::memory_order_acquire))
+      s.spin();
+  }
+  void unlock() { locked.store(false, std::memory_order_release); }
+};
+
+class LOCK_ALIGN ttasLock {
+  std::atomic<bool> locked;
+  enum { minBackoff = 4, maxBackoff = 1024 };
+
+ public:
+  ttasLock() : locked(false) {}
+  void lock() {
+    spinner s;
+    int backoff = minBackoff;
+    for (;;) {
+      while (locked.load(std::memory_order_relaxed))
+        s.spin();
+      if (!locked.exchange(true, std::memory_order_acquire))
+        return;
+      // Someone else got there first; let the rush die down.
+      for (int i = 0; i < backoff; i++)
+        cpuRelax();
+      if (backoff < maxBackoff)
+        backoff *= 2;
+    }
+  }
+  void unlock() { locked.store(false, std::memory_order_release); }
+};
+
+class LOCK_ALIGN ticketLock {
+  std::atomic<uint32_t> next;
+  std::atomic<uint32_t> serving;
+
+ public:
+  ticketLock() : next(0), serving(0) {}
+  void lock() {
+    uint32_t ticket = next.fetch_add(1, std::memory_order_relaxed);
+    spinner s;
+    while (serving.load(std::memory_order_acquire) != ticket)
+      s.spin();
+  }
+  void unlock() {
+    // Only the holder writes serving.
+    serving.store(serving.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_release);
+  }
+};
+
+class LOCK_ALIGN mcsLock {
+  struct LOCK_ALIGN node {
+    std::atomic<node *> next;
+    std::atomic<bool> waiting;
+  };
+  std::atomic<node *> tail;
+  static node & myNode() {
+    static thread_local node me;
+    return me;
+  }
+
+ public:
+  mcsLock() : tail(nullptr) {}
+  void lock() {
+    node & me = myNode();
+    me.next.store(nullptr, std::memory_order_relaxed);
+    me.waiting.store(true, std::memory_order_relaxed);
+    node * previous = tail.exchange(&me, std::memory_order_acq_rel);
+    if (!previous)
+      return;
+    previous->next.store(&me, std::memory_order_release);
+    spinner s;
+    while (me.waiting.load(std::memory_order_acquire))
+      s.spin();
+  }
+  void unlock() {
+    node & me = myNode();
+    node * successor = me.next.load(std::memory_order_acquire);
+    if (!successor) {
+      node * expected = &me;
+      if (tail.compare_exchange_strong(expected, nullptr,
+                                       std::memory_order_release,
+                                       std::memory_order_relaxed))
+        return;
+      // Someone has joined the queue, but not yet linked in behind us.
+      spinner s;
+      while (!(successor = me.next.load(std::memory_order_acquire)))
+        s.spin();
+    }
+    successor->waiting.store(false, std::memory_order_release);
+  }
+};
+
+class LOCK_ALIGN clhLock {
+  struct LOCK_ALIGN node {
+    std::atomic<bool> locked;
+  };
+  std::atomic<node *> tail;
+  // Nodes move between threads (and locks), so they're never freed; there
+  // are only ever as many as there are threads and locks.
+  struct threadNodes {
+    node * mine = nullptr;
+    node * predecessor = nullptr;
+  };
+  static threadNodes & myNodes() {
+    static thread_local threadNodes nodes;
+    return nodes;
+  }
+
+ public:
+  clhLock() : tail(new node()) {
+    tail.load()->locked.store(false);
+  }
+  void lock() {
+    threadNodes & my = myNodes();
+    if (!my.mine)
+      my.mine = new node();
+    my.mine->locked.store(true, std::memory_order_relaxed);
+    my.predecessor = tail.exchange(my.mine, std::memory_order_acq_rel);
+    spinner s;
+    while (my.predecessor->locked.load(std::memory_order_acquire))
+      s.spin();
+  }
+  void unlock() {
+    threadNodes & my = myNodes();
+    my.mine->locked.store(false, std::memory_order_release);
+    // Our successor is watching our node, but nobody is watching our
+    // predecessor's any more, so we can use it next time.
+    my.mine = my.predecessor;
+  }
+};
+
+class LOCK_ALIGN futexLock {
+  // 0: unlocked, 1: locked, 2: locked and there may be waiters.
+  std::atomic<int> state;
+
+  void futex(int op, int value) {
+    syscall(SYS_futex, reinterpret_cast<int *>(&state), op, value, nullptr,
+            nullptr, 0);
+  }
+
+ public:
+  futexLock() : state(0) {}
+  void lock() {
+    int c = 0;
+    if (state.compare_exchange_strong(c, 1, std::memory_order_acquire))
+      return;
+    if (c != 2)
+      c = state.exchange(2, std::memory_order_acquire);
+    while (c != 0) {
+      futex(FUTEX_WAIT_PRIVATE, 2);
+      c = state.exchange(2, std::memory_order_acquire);
+    }
+  }
+  void unlock() {
+    if (state.fetch_sub(1, std::memory_order_release) != 1) {
+      state.store(0, std::memory_order_release);
+      futex(FUTEX_WAKE_PRIVATE, 1);
+    }
+  }
+};
+
+class ompLock {
+  omp_lock_t theLock;
+
+ public:
+  ompLock() { omp_init_lock(&theLock); }
+  ~ompLock() { omp_destroy_lock(&theLock); }
+  void lock() { omp_set_lock(&theLock); }
+  void unlock() { omp_unset_lock(&theLock); }
+};
+
+#undef LOCK_ALIGN
+#endif
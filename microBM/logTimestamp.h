@@ -0,0 +1,202 @@
+/*
+ * Parse the timestamp at the start of a log line, without strptime.
+ *
+ * We only accept one fixed layout (ISO 8601, as most logs now use)
+ *     YYYY-MM-DDTHH:MM:SS[.fraction]
+ * where the T may also be a space, and the whole thing may be inside [].
+ * Anything after the seconds (or fraction) such as a Z or UTC offset is
+ * ignored, so times are only comparable within one time zone. Since every
+ * field is at a fixed offset, parsing is a matter of checking the
+ * separators and converting the digits; there's no searching or locale.
+ *
+ * We do that eight bytes at a time in 64 bit words (SWAR, "SIMD within a
+ * register"), which needs no intrinsics so works on any 64 bit machine: a
+ * few masks check that every digit is a digit and every separator is
+ * right, and one multiply and add turns each pair of digits into its
+ * value. Three overlapping loads cover the fixed part.
+ *
+ * We also count matches in fixed length intervals, for time series.
+ *
+ * License: Apache License v2.0 with LLVM Exceptions.
+ * See https://llvm.org/LICENSE.txt for license information.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+#ifndef MICROBM_LOG_TIMESTAMP_H
+#define MICROBM_LOG_TIMESTAMP_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// The fixed part, YYYY-MM-DDTHH:MM:SS.
+enum { timestampLength = 19 };
+
+// Days since 1970-01-01 in the proleptic Gregorian calendar; see Howard
+// Hinnant's "chrono-Compatible Low-Level Date Algorithms".
+inline int64_t daysFromCivil(int64_t y, unsigned m, unsigned d) {
+  y -= m <= 2;
+  int64_t era = (y >= 0 ? y : y - 399) / 400;
+  unsigned yoe = unsigned(y - era * 400);
+  unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + int64_t(doe) - 719468;
+}
+
+// Load eight bytes, so that the first is in the low byte.
+inline uint64_t loadBytes(char const * p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap64(v);
+#endif
+  return v;
+}
+
+// Are all the bytes selected by mask ASCII digits? Digits are 0x30-0x39, so
+// have 3 in the high nibble both before and after adding 6. Adding can only
+// carry out of a byte which is already not a digit, so carries don't
+// matter.
+inline bool allDigits(uint64_t v, uint64_t mask) {
+  uint64_t const high = 0xF0F0F0F0F0F0F0F0ull;
+  uint64_t const threes = 0x3030303030303030ull;
+  return (((v & high) ^ threes) & mask) == 0 &&
+         ((((v + 0x0606060606060606ull) & high) ^ threes) & mask) == 0;
+}
+
+// Byte i of the result is 10 * digit i + digit i+1, so the value of the two
+// digit number starting there; that's at most 99, so nothing carries.
+inline uint64_t digitPairs(uint64_t v) {
+  uint64_t d = v & 0x0F0F0F0F0F0F0F0Full;
+  return d * 10 + (d >> 8);
+}
+
+inline unsigned byteAt(uint64_t v, int i) {
+  return unsigned(v >> (8 * i)) & 0xFF;
+}
+
+// Parse the timestamp at p (not beyond end) into nanoseconds since the
+// epoch. Returns false if there isn't one.
+inline bool parseTimestamp(char const * p, char const * end, int64_t * ns) {
+  if (p < end && *p == '[')
+    p++;
+  if (end - p < timestampLength)
+    return false;
+  uint64_t date = loadBytes(p);      // YYYY-MM-
+  uint64_t time = loadBytes(p + 8);  // DDTHH:MM
+  uint64_t secs = loadBytes(p + 11); // HH:MM:SS
+  if (!allDigits(date, 0x00FFFF00FFFFFFFFull) ||
+      !allDigits(time, 0xFFFF00FFFF00FFFFull) ||
+      !allDigits(secs, 0xFFFF000000000000ull) ||
+      (date & 0xFF0000FF00000000ull) != 0x2D00002D00000000ull || // - -
+      (time & 0x0000FF0000000000ull) != 0x00003A0000000000ull || // :
+      (secs & 0x0000FF0000000000ull) != 0x00003A0000000000ull || // :
+      (p[10] != 'T' && p[10] != ' '))
+    return false;
+
+  date = digitPairs(date);
+  time = digitPairs(time);
+  secs = digitPairs(secs);
+  unsigned year = byteAt(date, 0) * 100 + byteAt(date, 2);
+  unsigned month = byteAt(date, 5);
+  unsigned day = byteAt(time, 0);
+  unsigned hour = byteAt(time, 3);
+  unsigned minute = byteAt(time, 6);
+  unsigned second = byteAt(secs, 6);
+  // Nanoseconds since 1970 in 64 bits only cover 1677 to 2262.
+  if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 ||
+      minute > 59 || second > 60 || year < 1678 || year > 2261)
+    return false;
+
+  int64_t fraction = 0;
+  p += timestampLength;
+  if (p < end && (*p == '.' || *p == ',')) {
+    int64_t scale = 100000000;
+    for (p++; p < end && unsigned(uint8_t(*p) - '0') <= 9; p++) {
+      fraction += (*p - '0') * scale;
+      scale /= 10;
+    }
+  }
+  int64_t seconds = daysFromCivil(year, month, day) * 86400 +
+                    hour * 3600 + minute * 60 + second;
+  *ns = seconds * 1000000000 + fraction;
+  return true;
+}
+
+// Format seconds since the epoch as YYYY-MM-DDTHH:MM:SS; the inverse of
+// daysFromCivil is from the same source.
+inline std::string formatTimestamp(int64_t seconds) {
+  int64_t days = seconds / 86400;
+  int64_t rest = seconds % 86400;
+  if (rest < 0) {
+    rest += 86400;
+    days--;
+  }
+  days += 719468;
+  int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+  unsigned doe = unsigned(days - era * 146097);
+  unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  unsigned mp = (5 * doy + 2) / 153;
+  unsigned day = doy - (153 * mp + 2) / 5 + 1;
+  unsigned month = mp < 10 ? mp + 3 : mp - 9;
+  int64_t year = int64_t(yoe) + era * 400 + (month <= 2);
+  // Big enough for any int64_t year, so that nothing can be truncated.
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), "%04lld-%02u-%02uT%02u:%02u:%02u",
+           (long long)year, month, day, unsigned(rest / 3600),
+           unsigned(rest / 60 % 60), unsigned(rest % 60));
+  return buffer;
+}
+
+// Counts for each interval of a fixed length, held as an array from the
+// first interval we've seen to the last. So that one bad timestamp can't
+// make that enormous, we refuse to span more than maxIntervals, and just
+// count anything which would as out of range.
+class intervalCounts {
+  int64_t first; // Index of the interval counts[0] is for
+  std::vector<long> counts;
+  long outOfRange;
+
+ public:
+  enum { maxIntervals = 1 << 24 };
+
+  intervalCounts() : first(0), outOfRange(0) {}
+
+  void add(int64_t interval, long n = 1) {
+    if (counts.empty()) {
+      first = interval;
+      counts.push_back(0);
+    } else if (interval < first) {
+      if (first + int64_t(counts.size()) - interval > maxIntervals) {
+        outOfRange += n;
+        return;
+      }
+      counts.insert(counts.begin(), size_t(first - interval), 0);
+      first = interval;
+    } else if (interval - first >= int64_t(counts.size())) {
+      if (interval - first >= maxIntervals) {
+        outOfRange += n;
+        return;
+      }
+      counts.resize(size_t(interval - first) + 1, 0);
+    }
+    counts[size_t(interval - first)] += n;
+  }
+
+  intervalCounts & operator+=(intervalCounts const & other) {
+    for (size_t i = 0; i < other.counts.size(); i++)
+      if (other.counts[i])
+        add(other.first + int64_t(i), other.counts[i]);
+    outOfRange += other.outOfRange;
+    return *this;
+  }
+
+  bool empty() const { return counts.empty(); }
+  int64_t firstInterval() const { return first; }
+  size_t size() const { return counts.size(); }
+  long operator[](size_t i) const { return counts[i]; }
+  long getOutOfRange() const { return outOfRange; }
+};
+#endif
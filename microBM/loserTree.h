@@ -0,0 +1,70 @@
+/*
+ * A tournament ("loser") tree for merging k sorted streams.
+ *
+ * Each internal node of a complete binary tree over the streams holds the
+ * stream which lost the match played there, and the overall winner is kept
+ * separately. When the winner's stream moves on to its next item, we only
+ * need to replay the matches on the path from its leaf to the root, against
+ * the losers stored there: log2(k) comparisons, one per level, and no
+ * comparisons between siblings as a heap would need (Knuth, TAOCP Vol 3,
+ * 5.4.1).
+ *
+ * less(a, b) compares the current items of streams a and b, and must put
+ * exhausted streams last.
+ *
+ * License: Apache License v2.0 with LLVM Exceptions.
+ * See https://llvm.org/LICENSE.txt for license information.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+#ifndef MICROBM_LOSER_TREE_H
+#define MICROBM_LOSER_TREE_H
+
+#include <utility>
+#include <vector>
+
+template <typename Less>
+class loserTree {
+  Less less;
+  int k;
+  // loser[1..k-1] are the internal nodes (node n's children are 2n and
+  // 2n+1, and stream i is leaf k+i); loser[0] is the winner.
+  std::vector<int> loser;
+
+  int build(int node) {
+    if (node >= k)
+      return node - k;
+    int a = build(2 * node);
+    int b = build(2 * node + 1);
+    if (less(b, a))
+      std::swap(a, b);
+    loser[node] = b;
+    return a;
+  }
+
+ public:
+  loserTree(int streams, Less const & l)
+      : less(l), k(streams), loser(streams > 0 ? streams : 1, -1) {
+    rebuild();
+  }
+
+  // Play every match again, e.g. after many streams have changed.
+  void rebuild() {
+    if (k > 0)
+      loser[0] = build(1);
+  }
+
+  // The stream with the smallest current item (which may be exhausted, if
+  // they all are), or -1 if there are no streams.
+  int winner() const { return loser[0]; }
+
+  // The winner's current item has changed; find the new winner.
+  void replay() {
+    int w = loser[0];
+    for (int node = (w + k) / 2; node >= 1; node /= 2) {
+      if (less(loser[node], w))
+        std::swap(loser[node], w);
+    }
+    loser[0] = w;
+  }
+};
+#endif
@@ -10,7 +10,8 @@
 /// This file looks at machine specific information to extract what we hope is the
 /// nominal CPU frequency of the core.
 /// On Intel cores that is included in the brand name extracted via cpuid
-/// On AMD cores it is not there and we have to measure it
+/// On AMD cores it is not there, so we ask the hypervisor (if there is one)
+/// or the kernel, and only if they can't tell us do we have to measure it.
 /// On Arm cores we can read it from a system register.
 /// Note that what we're actually looking at is the frequency at which the
 /// user-accessible high resolution timer runs. (That returned by rdtsc on x86_64,
@@ -18,8 +19,13 @@
 ///
 //===----------------------------------------------------------------------===//
 
+#include <cerrno>
+#include <cstdarg>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <limits>
 #include <string>
 #include <chrono>
 #include <iostream>
@@ -98,6 +104,10 @@ static double readHWTickTime() {
 }
 #elif (LOMP_TARGET_ARCH_X86_64)
 #include <x86intrin.h>
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 inline auto readCycleCount() {
   return __rdtsc();
 }
@@ -191,23 +201,20 @@ static bool haveInvariantTSC() {
 static std::string CPUModelName() {
   cpuid_t cpuinfo;
   auto brand = CPUBrandName();
-  int ids;
-  
-  if (brand == "GenuineIntel") {
-    // On Intel this gives the number of extra fields to read.
-    x86_cpuid(0x80000000, 0, &cpuinfo);
-    ids = cpuinfo.eax ^ 0x80000000;
-  } else if (brand == "AuthenticAMD") {
-    // Whereas AMD always support exactly three extra fields.
-    ids = 3;
-  } else {
-    fatalError("Unknown brand: %s", brand.c_str());
+
+  // Intel, AMD, Hygon, Zhaoxin and (most) hypervisors all put the 48 byte
+  // model name in leaves 0x80000002-4, so rather than trusting the vendor,
+  // check that those leaves exist. If they don't, the vendor is the best
+  // name we have.
+  x86_cpuid(0x80000000, 0, &cpuinfo);
+  if (cpuinfo.eax < 0x80000004) {
+    return brand;
   }
 
-  char model[256];
+  char model[3 * sizeof(cpuid_t) + 1];
   memset(&model[0], 0, sizeof(model));
 
-  for (unsigned int i = 0; i < ids; i++)
+  for (unsigned int i = 0; i < 3; i++)
     x86_cpuid(i + 0x80000002, 0, (cpuid_t *)(model + i * sizeof(cpuid_t)));
   // Remove trailing blanks.
   char * start = &model[0];
@@ -220,6 +227,9 @@ static std::string CPUModelName() {
   for (; *start == ' '; start++)
     ;
 
+  if (*start == char(0)) {
+    return brand;
+  }
   // errPrintf("CPU model name from cpuid: '%s'\n", start);
   return start;
 }
@@ -261,6 +271,112 @@ static bool extractLeaf15H(double * time) {
   return true;
 }
 
+// Hypervisors (VMware, KVM, Hyper-V, Xen, ...) can tell us the TSC
+// frequency in kHz in eax of cpuid leaf 0x40000010.
+// That is only there if we are running under a hypervisor (bit 31 of ecx
+// in leaf 1) and it says that it supports that leaf.
+static bool extractHypervisorLeaf(double * time) {
+  cpuid_t cpuinfo;
+
+  x86_cpuid(0x1, 0, &cpuinfo);
+  if ((cpuinfo.ecx & (1u << 31)) == 0) {
+    printf("   not running under a hypervisor\n");
+    return false;
+  }
+  x86_cpuid(0x40000000, 0, &cpuinfo);
+  if (cpuinfo.eax < 0x40000010) {
+    printf("   hypervisor does not support cpuid leaf 0x40000010\n");
+    return false;
+  }
+  x86_cpuid(0x40000010, 0, &cpuinfo);
+  if (cpuinfo.eax == 0) {
+    printf("   hypervisor leaf 0x40000010 does not give frequency\n");
+    return false;
+  }
+  *time = 1. / (cpuinfo.eax * 1000.);
+  printf("   hypervisor leaf 0x40000010: TSC %u kHz => %s\n", cpuinfo.eax,
+         formatSI(*time, 9, 's').c_str());
+  return true;
+}
+
+// Some kernels export their idea of the TSC frequency in sysfs.
+static bool readSysfsTSCFreq(double * time) {
+  char const * path = "/sys/devices/system/cpu/cpu0/tsc_freq_khz";
+  FILE * f = fopen(path, "r");
+  if (!f) {
+    printf("   %s does not exist\n", path);
+    return false;
+  }
+  unsigned long long khz = 0;
+  bool ok = fscanf(f, "%llu", &khz) == 1 && khz != 0;
+  fclose(f);
+  if (!ok) {
+    printf("   %s is not useful\n", path);
+    return false;
+  }
+  *time = 1. / (khz * 1000.);
+  printf("   %s: %llu kHz => %s\n", path, khz,
+         formatSI(*time, 9, 's').c_str());
+  return true;
+}
+
+// The kernel always knows tsc_khz, and, although it doesn't export it
+// directly, it does tell us how to convert TSC ticks to ns in the perf
+// mmap page of any event, so that user-space can do that itself. Since
+//    ns = (ticks * time_mult) >> time_shift
+// the tick time is time_mult / 2^time_shift ns.
+// We only ask for a software event on ourself, which is allowed without
+// privilege up to perf_event_paranoid 2. At 3 (the default on Debian and
+// Android) all unprivileged perf_event_open calls are refused, so this
+// fails, and (sysfs having already been tried) we fall back to the model
+// name or measuring.
+static bool readPerfTimeConversion(double * time) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_SOFTWARE;
+  attr.config = PERF_COUNT_SW_DUMMY;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  if (fd < 0) {
+    printf("   perf_event_open failed: %s\n", strerror(errno));
+    return false;
+  }
+  long pageSize = sysconf(_SC_PAGESIZE);
+  void * page = mmap(nullptr, pageSize, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (page == MAP_FAILED) {
+    printf("   mmap of perf event page failed: %s\n", strerror(errno));
+    return false;
+  }
+  auto pc = static_cast<perf_event_mmap_page const volatile *>(page);
+  bool ok = false;
+  uint32_t mult = 0;
+  uint16_t shift = 0;
+  // The kernel may update the page; lock is a sequence count.
+  for (int tries = 0; tries < 100; tries++) {
+    uint32_t seq = pc->lock;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    ok = pc->cap_user_time;
+    mult = pc->time_mult;
+    shift = pc->time_shift;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (pc->lock == seq)
+      break;
+  }
+  munmap(page, pageSize);
+  if (!ok || mult == 0) {
+    printf("   perf mmap page does not give TSC conversion\n");
+    return false;
+  }
+  *time = double(mult) / double(uint64_t(1) << shift) * 1.e-9;
+  printf("   perf mmap page: time_mult=%u, time_shift=%u => %s\n", mult,
+         unsigned(shift), formatSI(*time, 9, 's').c_str());
+  return true;
+}
+
 // Try to extract it from the brand string.
 static bool readHWTickTimeFromName(double * time) {
   auto modelName = CPUModelName();
@@ -296,25 +412,38 @@ static bool readHWTickTimeFromName(double * time) {
   return true;
 }
 
+// The places we can look, most trustworthy first.
+static struct {
+  char const * name;
+  bool (*read)(double *);
+} tickTimeSources[] = {
+    {"leaf 15H", extractLeaf15H},
+    {"hypervisor leaf 0x40000010", extractHypervisorLeaf},
+    {"sysfs tsc_freq_khz", readSysfsTSCFreq},
+    {"perf mmap page", readPerfTimeConversion},
+    {"model name string", readHWTickTimeFromName},
+};
+
+// Returns the name of the source which gave us the answer.
+static char const * findHWTickTime(double * time) {
+  for (auto const & source : tickTimeSources) {
+    if (source.read(time)) {
+      return source.name;
+    }
+  }
+  // OK, we can't find it, so we have to measure.
+  *time = measureTSCtick();
+  return "measurement";
+}
+
 static double readHWTickTime() {
   // First check whether TSC can sanely be used at all.
   if (!haveInvariantTSC()) {
     fatalError("TSC may not be invariant. Use another clock!");
   }
   double res;
-  // Try to get it from Intel's leaf15H
-  if (extractLeaf15H(&res)) {
-    return res;
-  }
-
-  // Try to get it from the brand name of the CPU (Intel have it there as a string),
-  // and do seem to have the TSC clock run at the notional CPU frequency.
-  if (readHWTickTimeFromName(&res)) {
-    return res;
-  }
-
-  // OK, we can't find it, so we have to measure.
-  return measureTSCtick();
+  findHWTickTime(&res);
+  return res;
 }
 #endif
 
@@ -388,17 +517,8 @@ int main(int, char **) {
     printf ("*** Without invariant TSC rdtsc is not a useful timer for wall clock time.\n");
     return 1;
   }
-  char const * source = "Unknown";
   double res;
-  // Try to get it from Intel's leaf15H
-  if (extractLeaf15H(&res)) {
-    source = "leaf 15H";
-  } else if (readHWTickTimeFromName(&res)) {
-    source = "model name string";
-  } else {
-      res = measureTSCtick();
-      source = "measurement";
-  }
+  char const * source = findHWTickTime(&res);
 
   printf ("   From %s frequency %sz => %s\n",
           source,
@@ -16,8 +16,60 @@
 
 #include <string>
 #include <iostream>
+#include <iomanip>
+#include <iterator>
 #include <regex>
+#include <vector>
+#include <memory>
+#include <set>
+#include <unordered_map>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
 #include <omp.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "approxMatch.h"
+#include "booleanQuery.h"
+#include "chunkDedup.h"
+#include "dfaMatch.h"
+#include "linearMatch.h"
+#include "locks.h"
+#include "logTimestamp.h"
+#include "loserTree.h"
+#include "spaceSaving.h"
+#include "timeHistogram.h"
+
+// Options which only some of the implementations care about.
+static struct {
+  std::string pattern;
+  size_t blockSize = 1024 * 1024;
+  dfaMode mode = dfaMode::lines;
+  std::string dfaCache;
+  int top = 10;
+  int counters = 1000;
+  int maxEdits = -1; // >= 0 for approximate matching
+  std::string chunkCache;
+  std::vector<std::string> files;
+  bool placement = false;
+  size_t lineBudget = 0;
+  bool budgeted = false; // Whether there's a lineBudget
+  int sample = 1000;
+  int window = 1000;
+  int interval = 60; // Seconds
+  std::string replacement;
+  std::string lock; // Empty for the usual critical sections
+} options;
+
+static dfaMatcher compileDFA() {
+  return dfaMatcher::cached(options.pattern, options.mode, options.dfaCache);
+}
 
 // Using std::string is unlikely to be the fastest way to handle this,
 // since it leads to lots of memory allocation/deallocation.
@@ -30,32 +82,144 @@ static bool getLine(std::string &line) {
   return !std::cin.eof();
 }
 
-// See https://en.cppreference.com/w/cpp/regex for details of how to
-// use the std::regex class.
-static bool lineMatches(std::regex const re, std::string & line) {
-  return std::regex_search(line, re);
+// How we match a line: either with a regular expression, or approximately,
+// allowing up to maxEdits edits.
+// Since std::regex backtracks, a regular expression can be given a budget
+// of steps per line; lines on which it might exceed that (which, for
+// patterns at risk of exponential backtracking, is all of them) are
+// matched with the linear time engine instead. std::regex can't count its
+// steps for us, so the budget is against the worst case we estimate from
+// the pattern (see backtrackRisk), which comes down to a length cutoff
+// chosen once, not against the work really done on each line.
+class lineMatcher {
+  std::regex re;
+  myersMatcher approx;
+  int maxEdits;
+  std::shared_ptr<linearMatcher const> linear;
+  // Longer lines use the linear engine; if it's zero, all of them do.
+  size_t longestBacktracked;
+
+ public:
+  lineMatcher() : maxEdits(-1), longestBacktracked(0) {}
+  // See https://en.cppreference.com/w/cpp/regex for details of how to
+  // use the std::regex class.
+  explicit lineMatcher(std::string const & pattern)
+    : re(pattern, std::regex::grep), maxEdits(-1),
+      longestBacktracked(std::numeric_limits<size_t>::max()) {}
+  lineMatcher(std::string const & pattern, size_t budget)
+    : maxEdits(-1), linear(std::make_shared<linearMatcher>(pattern)) {
+    // std::regex::grep takes these escapes literally, but our parser
+    // doesn't, so the engines would disagree.
+    for (size_t i=0; i+1<pattern.size(); i++) {
+      if (pattern[i] == '\\' && strchr("|+?", pattern[++i]))
+        throw patternError("\\| \\+ and \\? can't be used with "
+                           "--line-budget, since std::regex doesn't "
+                           "support them");
+    }
+    longestBacktracked =
+      backtrackRisk(breParser(pattern, false).parse()).longestLine(budget);
+    if (longestBacktracked > 0)
+      re = std::regex(pattern, std::regex::grep);
+  }
+  lineMatcher(std::string const & pattern, int edits)
+    : approx(pattern), maxEdits(edits), longestBacktracked(0) {}
+
+  size_t getLongestBacktracked() const { return longestBacktracked; }
+
+  // How many edits the match needed (always zero for a regex match),
+  // or noMatch.
+  enum { noMatch = -1 };
+  int match(std::string const & line) const {
+    if (maxEdits < 0) {
+      if (line.size() > longestBacktracked || longestBacktracked == 0)
+        return linear->search(line.data(), line.data() + line.size()) ?
+          0 : noMatch;
+      return std::regex_search(line, re) ? 0 : noMatch;
+    }
+    int edits = approx.distance(line.data(), line.data() + line.size(),
+                                maxEdits);
+    return edits <= maxEdits ? edits : noMatch;
+  }
+
+  // Append line to out with every match replaced, as sed's s/re/format/g
+  // would (so & and \1 to \9 can be used in format). Only for regular
+  // expressions, and only if they're always used (no line budget).
+  void replace(std::string const & line, std::string const & format,
+               std::string & out) const {
+    std::regex_replace(std::back_inserter(out), line.begin(), line.end(), re,
+                       format, std::regex_constants::format_sed);
+  }
+};
+
+// A regex lineMatcher, with the --line-budget if there is one.
+static lineMatcher makeLineMatcher(std::string const & pattern) {
+  return options.budgeted ? lineMatcher(pattern, options.lineBudget) :
+    lineMatcher(pattern);
+}
+
+static int lineMatches(lineMatcher const & matcher, std::string & line) {
+  return matcher.match(line);
 }
 
 // A class to handle our results.
 class fileStats {
+ public:
+  // The most edits we count matches for separately.
+  enum { maxDistance = 8 };
+  enum { maxPredicates = booleanQuery::maxPredicates };
+  
+ private:
   int lines;
   int matchedLines;
+  int distanceLines[maxDistance+1];
+  // For queries, how often we tested each pattern, and how often it matched.
+  long predicateTests[maxPredicates];
+  long predicateMatches[maxPredicates];
  public:
-  fileStats() : lines(0), matchedLines(0) {}
+  fileStats() { zero(); }
 
-  void zero() { lines=0; matchedLines=0; }
+  void zero() {
+    lines=0;
+    matchedLines=0;
+    std::fill(&distanceLines[0], &distanceLines[maxDistance+1], 0);
+    std::fill(&predicateTests[0], &predicateTests[maxPredicates], 0);
+    std::fill(&predicateMatches[0], &predicateMatches[maxPredicates], 0);
+  }
   int getLines() const { return lines; }
   int getMatchedLines() const { return matchedLines; }
+  int getDistanceLines(int distance) const { return distanceLines[distance]; }
+  long getPredicateTests(int p) const { return predicateTests[p]; }
+  long getPredicateMatches(int p) const { return predicateMatches[p]; }
   
   void incLines() { lines++; }
-  void incMatchedLines() { matchedLines++; }
-  void atomicIncMatchedLines() {
+  void incMatchedLines(int distance = 0) {
+    matchedLines++;
+    distanceLines[distance]++;
+  }
+  void countPredicate(int p, bool matched) {
+    predicateTests[p]++;
+    predicateMatches[p] += matched;
+  }
+  void addLines(long n) { lines += n; }
+  void addMatchedLines(long n) {
+    matchedLines += n;
+    distanceLines[0] += n;
+  }
+  void atomicIncMatchedLines(int distance = 0) {
     #pragma omp atomic
     matchedLines++;
+    #pragma omp atomic
+    distanceLines[distance]++;
   }
   fileStats & operator+=(fileStats const & other) {
     lines += other.lines;
     matchedLines += other.matchedLines;
+    for (int d=0; d<=maxDistance; d++)
+      distanceLines[d] += other.distanceLines[d];
+    for (int p=0; p<maxPredicates; p++) {
+      predicateTests[p] += other.predicateTests[p];
+      predicateMatches[p] += other.predicateMatches[p];
+    }
 
     return *this;
   }
@@ -67,15 +231,16 @@ class fileStats {
 };
 
 // The obvious, simple, serial code
-static fileStats runSerial(std::regex const &matchRE) {
+static fileStats runSerial(lineMatcher const &matchRE) {
   std::string line;
   fileStats res;
     
   while (getLine(line)) {
     res.incLines();
     
-    if (lineMatches(matchRE, line)){
-      res.incMatchedLines();
+    int distance = lineMatches(matchRE, line);
+    if (distance != lineMatcher::noMatch) {
+      res.incMatchedLines(distance);
     }
   }
   return res;
@@ -91,12 +256,48 @@ static bool criticalGetLine(std::string & line) {
   return res;
 }
 
+// The strategies which serialise on a lock can instead use any of the locks
+// in locks.h, so that we can compare them. criticalSection means the named
+// OpenMP critical sections, as before.
+struct criticalSection {};
+
+template <typename Lock>
+static bool lockedGetLine(std::string & line) {
+  static Lock lock;
+  lock.lock();
+  bool res = getLine(line);
+  lock.unlock();
+  return res;
+}
+
+template <>
+bool lockedGetLine<criticalSection>(std::string & line) {
+  return criticalGetLine(line);
+}
+
+// total += part, under a lock shared by everything adding to a T.
+template <typename Lock, typename T>
+static void lockedAdd(T & total, T const & part) {
+  static Lock lock;
+  lock.lock();
+  total += part;
+  lock.unlock();
+}
+
+template <>
+void lockedAdd<criticalSection, fileStats>(fileStats & total,
+                                           fileStats const & part) {
+#pragma omp critical (accumulateRes)
+  total += part;
+}
+
 // A simple parallel version; very similar to the serial one
 // except that we have to explicitly serialise reading and
 // combining per-thread results.
 // See below for a version using a user-defined reduction, which
 // is even closer to the serial version.
-static fileStats runParallel(std::regex const &matchRE) {
+template <typename Lock>
+static fileStats runParallel(lineMatcher const &matchRE) {
   fileStats fullRes;
   
 #pragma omp parallel shared(fullRes, matchRE)
@@ -104,21 +305,22 @@ static fileStats runParallel(std::regex const &matchRE) {
     std::string line;
     fileStats res;
 
-    while (criticalGetLine(line)) {
+    while (lockedGetLine<Lock>(line)) {
       res.incLines();
     
-      if (lineMatches(matchRE, line)){
-        res.incMatchedLines();
+      int distance = lineMatches(matchRE, line);
+      if (distance != lineMatcher::noMatch) {
+        res.incMatchedLines(distance);
       }
     }
     // Accumulate
-#pragma omp critical (accumulateRes)
-    fullRes += res;
+    lockedAdd<Lock>(fullRes, res);
   }
   return fullRes;
 }
 
-static fileStats runParallelRed(std::regex const &matchRE) {
+template <typename Lock>
+static fileStats runParallelRed(lineMatcher const &matchRE) {
   fileStats res;
   
 #pragma omp declare reduction (+: fileStats : omp_out += omp_in)
@@ -126,11 +328,12 @@ static fileStats runParallelRed(std::regex const &matchRE) {
   {
     std::string line;
 
-    while (criticalGetLine(line)) {
+    while (lockedGetLine<Lock>(line)) {
       res.incLines();
 
-      if (lineMatches(matchRE, line)){
-        res.incMatchedLines();
+      int distance = lineMatches(matchRE, line);
+      if (distance != lineMatcher::noMatch) {
+        res.incMatchedLines(distance);
       }
     }
   }
@@ -143,7 +346,29 @@ static fileStats runParallelRed(std::regex const &matchRE) {
 //
 #include <queue>
 
-template<typename T> class lockedQueue {
+template<typename T, typename Lock = criticalSection> class lockedQueue {
+  std::queue<T> theQueue;
+  Lock lock;
+
+ public:
+  void push(T value) {
+    lock.lock();
+    theQueue.push(value);
+    lock.unlock();
+  }
+  T pull() {
+    T res = 0;
+    lock.lock();
+    if (!theQueue.empty()) {
+      res = theQueue.front();
+      theQueue.pop();
+    }
+    lock.unlock();
+    return res;
+  }
+};
+
+template<typename T> class lockedQueue<T, criticalSection> {
   std::queue<T> theQueue;
   bool empty() const {
     bool res;
@@ -179,9 +404,10 @@ template<typename T> class lockedQueue {
 // the whole file, which may be sub-optimal!
 #include <atomic>
 
-static fileStats runParallelQueue(std::regex const &matchRE) {
+template <typename Lock>
+static fileStats runParallelQueue(lineMatcher const &matchRE) {
   fileStats res;
-  lockedQueue<std::string *> lineQueue;
+  lockedQueue<std::string *, Lock> lineQueue;
   // I find this easier to grok than the OpenMP flush directives!
   std::atomic<bool> done(false);
 
@@ -206,8 +432,9 @@ static fileStats runParallelQueue(std::regex const &matchRE) {
       std::string * line = lineQueue.pull();
       if (line) {
         res.incLines();
-        if (lineMatches(matchRE, *line)) {
-          res.incMatchedLines();
+        int distance = lineMatches(matchRE, *line);
+        if (distance != lineMatcher::noMatch) {
+          res.incMatchedLines(distance);
         }
         delete line;
       } else if (done) {
@@ -219,7 +446,7 @@ static fileStats runParallelQueue(std::regex const &matchRE) {
 }
 
 // Tasks using critical on each line to update global state.
-static fileStats runOmpTasks(std::regex const &matchRE) {
+static fileStats runOmpTasks(lineMatcher const &matchRE) {
   fileStats res;
   
 #pragma omp parallel
@@ -233,8 +460,9 @@ static fileStats runOmpTasks(std::regex const &matchRE) {
 #pragma omp task default(none),firstprivate(line),\
                  shared(matchRE, res)
         {
-          if (lineMatches(matchRE, *line)) {
-                res.atomicIncMatchedLines();
+          int distance = lineMatches(matchRE, *line);
+          if (distance != lineMatcher::noMatch) {
+                res.atomicIncMatchedLines(distance);
            delete line;
           }
         } // task
@@ -250,7 +478,7 @@ static fileStats runOmpTasks(std::regex const &matchRE) {
 // at the end.
 // If our tasks were untied, accessing thread privat state would
 // be undefined behaviour, however, by default tasks are tied so this is fine.
-static fileStats runOmpTasksTR(std::regex const &matchRE) {
+static fileStats runOmpTasksTR(lineMatcher const &matchRE) {
   fileStats res;
 #if (__GNUC__)
   // Work around GCC bug: https://gcc.gnu.org/bugzilla/show_bug.cgi?id=27557
@@ -275,8 +503,9 @@ static fileStats runOmpTasksTR(std::regex const &matchRE) {
         
 #pragma omp task default(none),firstprivate(line),shared(matchRE)
         {
-          if (lineMatches(matchRE, *line)) {
-            threadRes.incMatchedLines();
+          int distance = lineMatches(matchRE, *line);
+          if (distance != lineMatcher::noMatch) {
+            threadRes.incMatchedLines(distance);
           }
           delete line;
         } // task
@@ -293,7 +522,7 @@ static fileStats runOmpTasksTR(std::regex const &matchRE) {
 
 #if (USE_TASKREDUCTION)
 // Broken. SEGVs with g++ 10... (could well be broken code, though).
-static fileStats runOmpTasksRed(std::regex const &matchRE) {
+static fileStats runOmpTasksRed(lineMatcher const &matchRE) {
   fileStats res;
   
 #pragma omp declare reduction (+: fileStats : omp_out += omp_in)
@@ -308,8 +537,9 @@ static fileStats runOmpTasksRed(std::regex const &matchRE) {
         
 #pragma omp task default(none),firstprivate(line),shared(matchRE), in_reduction(+:res)
         {
-          if (lineMatches(matchRE, *line)) {
-            res.incMatchedLines();
+          int distance = lineMatches(matchRE, *line);
+          if (distance != lineMatcher::noMatch) {
+            res.incMatchedLines(distance);
           }
           delete line;
         } // end of the task
@@ -322,18 +552,858 @@ static fileStats runOmpTasksRed(std::regex const &matchRE) {
 }
 #endif
 
+//
+// Which matching lines are the most common?
+// Each thread keeps a Space-Saving summary of the lines it matches, so
+// memory is fixed however big the input, and we merge them at the end.
+//
+template <>
+void lockedAdd<criticalSection, spaceSaving>(spaceSaving & total,
+                                             spaceSaving const & part) {
+#pragma omp critical (mergeSummary)
+  total += part;
+}
+
+template <typename Lock>
+static fileStats runTopK(lineMatcher const &matchRE) {
+  fileStats res;
+  spaceSaving summary(options.counters);
+  
+#pragma omp declare reduction (+: fileStats : omp_out += omp_in)
+#pragma omp parallel shared(matchRE, summary), reduction(+:res)
+  {
+    std::string line;
+    spaceSaving mine(options.counters);
+    
+    while (lockedGetLine<Lock>(line)) {
+      res.incLines();
+      
+      int distance = lineMatches(matchRE, line);
+      if (distance != lineMatcher::noMatch) {
+        res.incMatchedLines(distance);
+        mine.add(line);
+      }
+    }
+    lockedAdd<Lock>(summary, mine);
+  }
+
+  std::cout << "Top " << options.top << " matching lines; any line occurring "
+    "more than " << summary.getTotal() / summary.getCapacity() <<
+    " times is present\n" <<
+    "     Count   At least  Line\n";
+  for (auto const & c : summary.top(options.top)) {
+    std::cout << std::setw(10) << c.count << " " << std::setw(10) <<
+      c.count - c.error << "  " << c.item << "\n";
+  }
+  return res;
+}
+
+//
+// Boolean queries over several patterns, e.g. "/a/ AND NOT /b/".
+// We read a sample of lines first, and time each pattern on them, so that
+// we can plan the order in which to test the patterns. Then we scan as in
+// runParallel, counting how often each pattern is tested and matches.
+//
+static fileStats runQuery(lineMatcher const &) {
+  booleanQuery query(options.pattern);
+  int numPatterns = query.size();
+  std::vector<lineMatcher> matchers;
+  for (int i=0; i<numPatterns; i++) {
+    matchers.push_back(makeLineMatcher(query.pattern(i)));
+  }
+
+  std::vector<std::string> sample;
+  std::string line;
+  while (int(sample.size()) < options.sample && getLine(line)) {
+    sample.push_back(line);
+  }
+  std::vector<double> cost(numPatterns, 0.0);
+  std::vector<double> selectivity(numPatterns, 0.5);
+  if (!sample.empty()) {
+    for (int i=0; i<numPatterns; i++) {
+      long matched = 0;
+      double start = omp_get_wtime();
+      for (auto & l : sample) {
+        matched += lineMatches(matchers[i], l) != lineMatcher::noMatch;
+      }
+      cost[i] = (omp_get_wtime() - start) / sample.size();
+      selectivity[i] = double(matched) / sample.size();
+    }
+  }
+  query.plan(cost, selectivity);
+
+  auto matches = [&](std::string & l, fileStats & res) {
+    bool matched = query.evaluate([&](int i) {
+        bool m = lineMatches(matchers[i], l) != lineMatcher::noMatch;
+        res.countPredicate(i, m);
+        return m;
+      });
+    res.incLines();
+    if (matched)
+      res.incMatchedLines();
+  };
+  fileStats fullRes;
+  for (auto & l : sample) {
+    matches(l, fullRes);
+  }
+#pragma omp parallel shared(fullRes, matchers, query)
+  {
+    std::string line;
+    fileStats res;
+
+    while (criticalGetLine(line)) {
+      matches(line, res);
+    }
+#pragma omp critical (accumulateRes)
+    fullRes += res;
+  }
+
+  std::cout << "Plan: " << query.describe() << "\n" <<
+    "  estimated " << query.estimatedCost() * 1.e9 << " ns/line, " <<
+    "selectivity " << query.estimatedSelectivity() << " from " <<
+    sample.size() << " sample lines\n" <<
+    " Pattern   Sample ns/line  Selectivity      Tested     Matched\n";
+  for (int i=0; i<numPatterns; i++) {
+    std::cout << std::setw(8) << query.written(i) << " " <<
+      std::setw(15) << cost[i] * 1.e9 << " " << std::setw(12) <<
+      selectivity[i] << " " << std::setw(11) << fullRes.getPredicateTests(i) <<
+      " " << std::setw(11) << fullRes.getPredicateMatches(i) << "\n";
+  }
+  return fullRes;
+}
+
+//
+// Block based reading.
+// Rather than reading lines, read fixed size blocks and run a DFA over them.
+// Lines can be any length; a line which spans several blocks is matched
+// as we go, with only the DFA state carried from one block to the next, so
+// we never need more than a block of the input in memory.
+//
+static ssize_t readBlock(char * buffer) {
+  size_t got = 0;
+  while (got < options.blockSize) {
+    ssize_t res = read(0, buffer + got, options.blockSize - got);
+    if (res <= 0)
+      break;
+    got += res;
+  }
+  return got;
+}
+
+// The last line may not have a newline, but it's still a line.
+static void finishLastLine(dfaMatcher const & dfa, int state, bool midLine,
+                           fileStats & res) {
+  if (midLine) {
+    res.incLines();
+    if (dfa.matchesAtEnd(state))
+      res.incMatchedLines();
+  }
+}
+
+static fileStats runBlock(lineMatcher const &) {
+  dfaMatcher dfa = compileDFA();
+  std::vector<char> buffer(options.blockSize);
+  fileStats res;
+  int state = dfa.initial();
+  bool midLine = false;
+  ssize_t got;
+  
+  while ((got = readBlock(buffer.data())) > 0) {
+    long lines = 0, matches = 0;
+    state = dfa.scan(state, buffer.data(), buffer.data() + got, &lines,
+                     &matches);
+    res.addLines(lines);
+    res.addMatchedLines(matches);
+    midLine = buffer[got-1] != '\n';
+  }
+  finishLastLine(dfa, state, midLine, res);
+  return res;
+}
+
+// Each thread reads a block and matches the lines which start in it.
+// The line which runs in from the previous block needs the DFA state at the
+// end of that block, so that is handed on from each block to the next in
+// order. We only wait for it after we've done all the independent work in
+// our block, so unless a line covers the whole block the wait is short.
+static fileStats runParallelBlock(lineMatcher const &) {
+  dfaMatcher dfa = compileDFA();
+  fileStats res;
+  long nextBlock = 0;
+  // The state at the end of block carriedBlock.
+  std::atomic<long> carriedBlock(-1);
+  int carriedState = dfa.initial();
+  bool carriedMidLine = false;
+  
+#pragma omp declare reduction (+: fileStats : omp_out += omp_in)
+#pragma omp parallel shared(dfa, nextBlock, carriedBlock, carriedState, \
+                            carriedMidLine), reduction(+:res)
+  {
+    std::vector<char> buffer(options.blockSize);
+    for (;;) {
+      long block;
+      ssize_t got;
+#pragma omp critical (readBlock)
+      {
+        got = readBlock(buffer.data());
+        block = nextBlock++;
+      }
+      if (got <= 0)
+        break;
+
+      char const * begin = buffer.data();
+      char const * end = begin + got;
+      char const * firstLine = static_cast<char const *>(
+          memchr(begin, '\n', got));
+      long lines = 0, matches = 0;
+      int endState = dfa.initial();
+      if (firstLine) {
+        firstLine++;
+        endState = dfa.scan(endState, firstLine, end, &lines, &matches);
+      } else {
+        firstLine = end;
+      }
+      
+      // Wait for the state from the previous block.
+      while (carriedBlock.load(std::memory_order_acquire) != block-1) {
+      }
+      int state = dfa.scan(carriedState, begin, firstLine, &lines, &matches);
+      if (firstLine == end) {
+        // No newline, so this block all belongs to the carried in line.
+        endState = state;
+      }
+      carriedState = endState;
+      carriedMidLine = end[-1] != '\n';
+      carriedBlock.store(block, std::memory_order_release);
+      
+      res.addLines(lines);
+      res.addMatchedLines(matches);
+    }
+  }
+  finishLastLine(dfa, carriedState, carriedMidLine, res);
+  return res;
+}
+
+//
+// Matching across lines.
+// If patterns can match newlines we can't split the work by lines, since
+// we don't know the state at the start of each chunk until the previous
+// one has been scanned. Instead, we speculatively scan each chunk from
+// every state we could be in, which, since we cut chunks just after a
+// newline, is only those the DFA can reach on a newline. Then we
+// chain the chunks together serially, picking the right result for each.
+//
+
+// The whole of a file (by default stdin); mapped if we can, otherwise read.
+class wholeInput {
+  char const * data;
+  size_t length;
+  bool mapped;
+  std::vector<char> copy;
+  
+ public:
+  explicit wholeInput(int fd = 0) : data(0), length(0), mapped(false) {
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+      void * map = mmap(0, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map != MAP_FAILED) {
+        data = static_cast<char const *>(map);
+        length = info.st_size;
+        mapped = true;
+        return;
+      }
+    }
+    ssize_t got;
+    copy.resize(options.blockSize);
+    while ((got = read(fd, copy.data() + length, copy.size() - length)) > 0) {
+      length += got;
+      if (length == copy.size())
+        copy.resize(2 * copy.size());
+    }
+    data = copy.data();
+  }
+  ~wholeInput() {
+    if (mapped)
+      munmap(const_cast<char *>(data), length);
+  }
+  char const * begin() const { return data; }
+  char const * end() const { return data + length; }
+  // Moving would need care with the mapping, and we don't need it.
+  wholeInput(wholeInput const &) = delete;
+  wholeInput & operator=(wholeInput const &) = delete;
+};
+
+// Cut into chunks of about the block size, each starting after a newline.
+// Chunk c is [cuts[c], cuts[c+1]).
+static std::vector<char const *> lineAlignedCuts(wholeInput const & input) {
+  std::vector<char const *> cuts = {input.begin()};
+  for (char const * p = input.begin() + options.blockSize; p < input.end();) {
+    char const * newline = static_cast<char const *>(
+        memchr(p, '\n', input.end() - p));
+    if (!newline || newline + 1 == input.end())
+      break;
+    cuts.push_back(newline + 1);
+    p = newline + 1 + options.blockSize;
+  }
+  cuts.push_back(input.end());
+  return cuts;
+}
+
+static fileStats runSpeculative(lineMatcher const &) {
+  dfaMatcher dfa = compileDFA();
+  wholeInput input;
+  std::vector<char const *> cuts = lineAlignedCuts(input);
+  
+  int numChunks = int(cuts.size()) - 1;
+  std::vector<int> starts = dfa.newlineTargets();
+  std::vector<speculativeScan> chunks(numChunks);
+#pragma omp parallel for schedule(dynamic), shared(dfa, starts, cuts, chunks)
+  for (int c=0; c<numChunks; c++) {
+    // We know where the first chunk starts.
+    chunks[c] = speculate(dfa, c == 0 ? std::vector<int>{dfa.initial()} : starts,
+                          cuts[c], cuts[c+1]);
+  }
+
+  // Chain them together.
+  fileStats res;
+  int state = dfa.initial();
+  for (int c=0; c<numChunks; c++) {
+    int which = chunks[c].find(state);
+    long matches = 0;
+    if (which >= 0) {
+      res.addLines(chunks[c].lines);
+      matches = chunks[c].matches[which];
+      state = chunks[c].endState[which];
+    } else {
+      // Can't happen, since we cut after a newline, but just in case...
+      long lines = 0;
+      state = dfa.scan(state, cuts[c], cuts[c+1], &lines, &matches);
+      res.addLines(lines);
+    }
+    res.addMatchedLines(matches);
+  }
+  finishLastLine(dfa, state,
+                 input.begin() != input.end() && input.end()[-1] != '\n', res);
+  return res;
+}
+
+//
+// Deduplication.
+// Cut the input (stdin, or each of the files we were given) into content
+// defined chunks of whole lines, and only scan chunks we haven't seen
+// before, in this run or (with --chunk-cache) a previous one.
+//
+struct chunk {
+  char const * begin;
+  char const * end;
+  chunkHash hash;
+  int scanned;    // Index of the chunk we scanned for this content, or -1
+  chunkResult result;
+};
+
+// Map the files we were given, or stdin if there weren't any, returning the
+// names of those we could open.
+static std::vector<std::unique_ptr<wholeInput>>
+mapInputs(std::vector<std::string> & names) {
+  std::vector<std::unique_ptr<wholeInput>> inputs;
+  if (options.files.empty()) {
+    inputs.emplace_back(new wholeInput());
+    names.push_back("(standard input)");
+  }
+  for (auto const & name : options.files) {
+    int fd = open(name.c_str(), O_RDONLY);
+    if (fd < 0) {
+      perror(name.c_str());
+      continue;
+    }
+    inputs.emplace_back(new wholeInput(fd));
+    names.push_back(name);
+    close(fd);
+  }
+  return inputs;
+}
+
+static fileStats runDedup(lineMatcher const &) {
+  dfaMatcher dfa = compileDFA();
+  gearChunker chunker(options.blockSize);
+  chunkResultCache cache;
+  if (!options.chunkCache.empty()) {
+    mkdir(options.chunkCache.c_str(), 0777);
+    // Include the engine version, in case that changes what we match.
+    cache = chunkResultCache(options.chunkCache,
+                             "dfa" + std::to_string(dfaMatcher::version()) +
+                             ":" + options.pattern);
+  }
+  
+  std::vector<std::string> names;
+  std::vector<std::unique_ptr<wholeInput>> inputs = mapInputs(names);
+  
+  // Chunk and hash each input in parallel.
+  double start = omp_get_wtime();
+  int numInputs = int(inputs.size());
+  std::vector<std::vector<chunk>> inputChunks(numInputs);
+#pragma omp parallel for schedule(dynamic)
+  for (int i=0; i<numInputs; i++) {
+    char const * end = inputs[i]->end();
+    for (char const * p = inputs[i]->begin(); p < end;) {
+      char const * cut = chunker.nextCut(p, end);
+      inputChunks[i].push_back({p, cut, hashChunk(p, cut - p), -1, {0, 0}});
+      p = cut;
+    }
+  }
+  std::vector<chunk> chunks;
+  for (auto & c : inputChunks)
+    chunks.insert(chunks.end(), c.begin(), c.end());
+  double chunkTime = omp_get_wtime() - start;
+
+  // Find which chunks need to be scanned.
+  std::vector<int> toScan;
+  std::unordered_map<chunkHash, int, chunkHashHasher> firstSeen;
+  long cachedChunks = 0;
+  int numChunks = int(chunks.size());
+  for (int c=0; c<numChunks; c++) {
+    if (cache.find(chunks[c].hash, &chunks[c].result)) {
+      cachedChunks++;
+      continue;
+    }
+    auto it = firstSeen.emplace(chunks[c].hash, c);
+    chunks[c].scanned = it.first->second;
+    if (it.second)
+      toScan.push_back(c);
+  }
+
+  // Scan the new ones. A chunk is whole lines, except perhaps at the end of
+  // an input, so we can start each in the DFA's initial state.
+  start = omp_get_wtime();
+  int numToScan = int(toScan.size());
+#pragma omp parallel for schedule(dynamic)
+  for (int i=0; i<numToScan; i++) {
+    chunk & c = chunks[toScan[i]];
+    long lines = 0, matches = 0;
+    int state = dfa.scan(dfa.initial(), c.begin, c.end, &lines, &matches);
+    if (c.end[-1] != '\n') {
+      lines++;
+      matches += dfa.matchesAtEnd(state);
+    }
+    c.result = {lines, matches};
+  }
+  double scanTime = omp_get_wtime() - start;
+
+  fileStats res;
+  size_t totalBytes = 0, scannedBytes = 0;
+  for (auto & c : chunks) {
+    if (c.scanned >= 0)
+      c.result = chunks[c.scanned].result;
+    res.addLines(c.result.lines);
+    res.addMatchedLines(c.result.matches);
+    totalBytes += c.end - c.begin;
+  }
+  for (int c : toScan) {
+    scannedBytes += chunks[c].end - chunks[c].begin;
+    cache.add(chunks[c].hash, chunks[c].result);
+  }
+  cache.save();
+
+  // Estimate what we saved from the rate at which we scanned.
+  double scanRate = scannedBytes ? scannedBytes / scanTime : 0.0;
+  std::cout << "Dedup: " << numChunks << " chunks, " << totalBytes <<
+    " bytes; scanned " << toScan.size() << " chunks, " << scannedBytes <<
+    " bytes; " << cachedChunks << " chunks from the cache\n" <<
+    "  Chunking " << chunkTime << " s, scanning " << scanTime << " s";
+  if (scanRate > 0.0) {
+    std::cout << ", dedup ratio " << double(totalBytes) / scannedBytes <<
+      ", saved about " << (totalBytes - scannedBytes) / scanRate << " s";
+  } else {
+    std::cout << ", nothing needed scanning";
+  }
+  std::cout << std::endl;
+  return res;
+}
+
+//
+// Merging.
+// Scan each of the files for matching lines, and print them all in the
+// order of the timestamps at their starts (lines without one, such as the
+// rest of a stack trace, take the time of the line before). Each file's
+// matches go into a window of at most --window lines, and a loser tree
+// merges the heads of the windows. When a window empties we refill it,
+// topping up any others which are getting low at the same time, so that
+// the scanning is done in parallel.
+//
+struct timedLine {
+  int64_t time;
+  char const * begin;
+  char const * end;
+};
+
+struct logStream {
+  std::string name;
+  std::unique_ptr<wholeInput> input;
+  char const * next;  // Where to carry on scanning
+  int64_t lastTime;   // Of the last line which had a timestamp
+  std::vector<timedLine> window;
+  size_t head;        // The first unmerged line in the window
+  fileStats stats;
+
+  size_t buffered() const { return window.size() - head; }
+  bool atEnd() const { return next == input->end(); }
+  bool exhausted() const { return buffered() == 0 && atEnd(); }
+
+  void refill(lineMatcher const & matchRE) {
+    window.erase(window.begin(), window.begin() + head);
+    head = 0;
+    std::string line;
+    char const * end = input->end();
+    while (window.size() < size_t(options.window) && next < end) {
+      char const * newline = static_cast<char const *>(
+          memchr(next, '\n', end - next));
+      char const * lineEnd = newline ? newline : end;
+      int64_t time;
+      if (parseTimestamp(next, lineEnd, &time))
+        lastTime = time;
+      line.assign(next, lineEnd);
+      stats.incLines();
+      int distance = lineMatches(matchRE, line);
+      if (distance != lineMatcher::noMatch) {
+        stats.incMatchedLines(distance);
+        window.push_back({lastTime, next, lineEnd});
+      }
+      next = newline ? newline + 1 : end;
+    }
+  }
+};
+
+static fileStats runMerge(lineMatcher const &matchRE) {
+  std::vector<std::string> names;
+  std::vector<std::unique_ptr<wholeInput>> inputs = mapInputs(names);
+  int numStreams = int(inputs.size());
+  std::vector<logStream> streams(numStreams);
+  for (int i=0; i<numStreams; i++) {
+    streams[i].name = names[i];
+    streams[i].input = std::move(inputs[i]);
+    streams[i].next = streams[i].input->begin();
+    streams[i].lastTime = std::numeric_limits<int64_t>::min();
+    streams[i].head = 0;
+  }
+
+  // Ties go to the earlier file, so the order is deterministic.
+  auto less = [&streams](int a, int b) {
+    logStream const & sa = streams[a];
+    logStream const & sb = streams[b];
+    if (sa.buffered() == 0 || sb.buffered() == 0)
+      return sb.buffered() == 0 && (sa.buffered() != 0 || a < b);
+    int64_t ta = sa.window[sa.head].time;
+    int64_t tb = sb.window[sb.head].time;
+    return ta < tb || (ta == tb && a < b);
+  };
+  loserTree<decltype(less)> tree(numStreams, less);
+
+  long merged = 0;
+  int refills = 0;
+  std::vector<int> toRefill;
+  for (;;) {
+    // Refill every window that's less than half full, in parallel.
+    toRefill.clear();
+    for (int i=0; i<numStreams; i++) {
+      if (!streams[i].atEnd() &&
+          streams[i].buffered() <= size_t(options.window) / 2)
+        toRefill.push_back(i);
+    }
+    int numRefills = int(toRefill.size());
+#pragma omp parallel for schedule(dynamic), shared(streams, toRefill, matchRE)
+    for (int r=0; r<numRefills; r++) {
+      streams[toRefill[r]].refill(matchRE);
+    }
+    refills += numRefills;
+    if (std::all_of(streams.begin(), streams.end(),
+                    [](logStream const & s) { return s.exhausted(); }))
+      break;
+    tree.rebuild();
+
+    // Merge until a window which may have more to come runs dry, since its
+    // next line could be earlier than any of the others.
+    for (;;) {
+      logStream & s = streams[tree.winner()];
+      if (s.buffered() == 0)
+        break; // They're all exhausted.
+      timedLine const & l = s.window[s.head++];
+      std::cout << s.name << ":";
+      std::cout.write(l.begin, l.end - l.begin);
+      std::cout << "\n";
+      merged++;
+      if (s.buffered() == 0 && !s.atEnd())
+        break;
+      tree.replay();
+    }
+  }
+
+  fileStats res;
+  for (auto const & s : streams) {
+    res += s.stats;
+  }
+  std::cout << "Merged " << merged << " lines from " << numStreams <<
+    " files, with " << refills << " window refills" << std::endl;
+  return res;
+}
+
+//
+// Time series.
+// Count the matching lines in each --interval long period, from the
+// timestamps at their starts. Each thread counts into its own array of
+// intervals, and they're combined by a user defined reduction.
+//
+static fileStats runTimeSeries(lineMatcher const &matchRE) {
+  wholeInput input;
+  std::vector<char const *> cuts = lineAlignedCuts(input);
+  int numChunks = int(cuts.size()) - 1;
+  int64_t const interval = int64_t(options.interval) * 1000000000;
+
+  fileStats res;
+  intervalCounts series;
+  long untimed = 0;
+#pragma omp declare reduction (+: fileStats : omp_out += omp_in)
+#pragma omp declare reduction (+: intervalCounts : omp_out += omp_in)
+#pragma omp parallel for schedule(dynamic), shared(matchRE, cuts), \
+  reduction(+:res, series, untimed)
+  for (int c=0; c<numChunks; c++) {
+    std::string line;
+    for (char const * p = cuts[c]; p < cuts[c+1];) {
+      char const * newline = static_cast<char const *>(
+          memchr(p, '\n', cuts[c+1] - p));
+      char const * lineEnd = newline ? newline : cuts[c+1];
+      line.assign(p, lineEnd);
+      res.incLines();
+      int distance = lineMatches(matchRE, line);
+      if (distance != lineMatcher::noMatch) {
+        res.incMatchedLines(distance);
+        int64_t time;
+        if (parseTimestamp(p, lineEnd, &time)) {
+          // Round down, even before 1970.
+          series.add(time >= 0 ? time / interval :
+                     (time - interval + 1) / interval);
+        } else {
+          untimed++;
+        }
+      }
+      p = newline ? newline + 1 : lineEnd;
+    }
+  }
+
+  std::cout << "Matching lines per " << options.interval << " s interval\n";
+  for (size_t i=0; i<series.size(); i++) {
+    std::cout << formatTimestamp((series.firstInterval() + int64_t(i)) *
+                                 options.interval) <<
+      ", " << series[i] << "\n";
+  }
+  if (untimed) {
+    std::cout << untimed << " matching lines had no timestamp\n";
+  }
+  if (series.getOutOfRange()) {
+    std::cout << series.getOutOfRange() << " matching lines were more than " <<
+      int(intervalCounts::maxIntervals) << " intervals from the others\n";
+  }
+  return res;
+}
+
+//
+// Substitution.
+// Rewrite the input to stdout, replacing every match, like sed s/re/text/g.
+// Chunks are rewritten in parallel, each into a list of pieces: runs of
+// unchanged lines are just pointers into the input, and only rewritten
+// lines are copied, into a buffer which grows as needed. Then the chunks
+// are written in order, each with writev, so when few lines match we copy
+// very little more than the match-only scan does.
+//
+struct outputChunk {
+  struct piece {
+    bool rewritten;   // In text, rather than the input
+    char const * input;
+    size_t offset;    // Into text; it may move as it grows
+    size_t length;
+  };
+  std::vector<piece> pieces;
+  std::string text;
+
+  void addInput(char const * p, size_t length) {
+    if (!pieces.empty() && !pieces.back().rewritten &&
+        pieces.back().input + pieces.back().length == p) {
+      pieces.back().length += length;
+    } else {
+      pieces.push_back({false, p, 0, length});
+    }
+  }
+  // Call before appending to text.
+  void startRewrite() {
+    if (pieces.empty() || !pieces.back().rewritten)
+      pieces.push_back({true, 0, text.size(), 0});
+  }
+  // Call after.
+  void endRewrite() {
+    pieces.back().length = text.size() - pieces.back().offset;
+  }
+
+  // Write it all to fd, coping with short writes and the limit on the
+  // number of iovecs per call.
+  bool write(int fd) const {
+    std::vector<iovec> iov;
+    for (auto const & p : pieces) {
+      char const * base = p.rewritten ? text.data() + p.offset : p.input;
+      iov.push_back({const_cast<char *>(base), p.length});
+    }
+    size_t next = 0;
+    while (next < iov.size()) {
+      int count = int(std::min<size_t>(iov.size() - next, IOV_MAX));
+      ssize_t written = writev(fd, &iov[next], count);
+      if (written < 0) {
+        if (errno == EINTR)
+          continue;
+        return false;
+      }
+      // Skip what was written, which may end part way through an iovec.
+      while (next < iov.size() && size_t(written) >= iov[next].iov_len) {
+        written -= iov[next].iov_len;
+        next++;
+      }
+      if (written) {
+        iov[next].iov_base = static_cast<char *>(iov[next].iov_base) + written;
+        iov[next].iov_len -= written;
+      }
+    }
+    return true;
+  }
+};
+
+static fileStats runSubstitute(lineMatcher const &matchRE) {
+  wholeInput input;
+  std::vector<char const *> cuts = lineAlignedCuts(input);
+  int numChunks = int(cuts.size()) - 1;
+  bool ok = true;
+
+  fileStats res;
+#pragma omp declare reduction (+: fileStats : omp_out += omp_in)
+#pragma omp parallel for ordered schedule(dynamic), \
+  shared(matchRE, cuts, ok), reduction(+:res)
+  for (int c=0; c<numChunks; c++) {
+    outputChunk out;
+    std::string line;
+    for (char const * p = cuts[c]; p < cuts[c+1];) {
+      char const * newline = static_cast<char const *>(
+          memchr(p, '\n', cuts[c+1] - p));
+      char const * lineEnd = newline ? newline : cuts[c+1];
+      char const * next = newline ? newline + 1 : lineEnd;
+      line.assign(p, lineEnd);
+      res.incLines();
+      if (lineMatches(matchRE, line) != lineMatcher::noMatch) {
+        res.incMatchedLines();
+        out.startRewrite();
+        matchRE.replace(line, options.replacement, out.text);
+        out.text.append(lineEnd, next);
+        out.endRewrite();
+      } else {
+        out.addInput(p, next - p);
+      }
+      p = next;
+    }
+#pragma omp ordered
+    if (ok && !out.write(1)) {
+      perror("writev");
+      ok = false;
+    }
+  }
+  return res;
+}
+
+//
+// Profiling.
+// Time the match of every line, and of every block sized chunk, so that we
+// can see how the times are distributed, and find the regions of the input
+// which hit the matcher's worst cases (very long lines, or lines which make
+// the regex engine backtrack). The timing itself costs a little, so this is
+// for finding out what's going on, not for comparing against the others.
+//
+static fileStats runProfile(lineMatcher const &matchRE) {
+  wholeInput input;
+  std::vector<char const *> cuts = lineAlignedCuts(input);
+  int numChunks = int(cuts.size()) - 1;
+
+  fileStats res;
+  logHistogram lineTimes, chunkTimes;
+  slowestRanges slowLines(options.top), slowChunks(options.top);
+#pragma omp parallel shared(res, lineTimes, chunkTimes, slowLines, slowChunks)
+  {
+    fileStats myRes;
+    logHistogram myLineTimes, myChunkTimes;
+    slowestRanges mySlowLines(options.top), mySlowChunks(options.top);
+    std::string line;
+#pragma omp for schedule(dynamic)
+    for (int c=0; c<numChunks; c++) {
+      double chunkStart = omp_get_wtime();
+      for (char const * p = cuts[c]; p < cuts[c+1];) {
+        char const * newline = static_cast<char const *>(
+            memchr(p, '\n', cuts[c+1] - p));
+        char const * lineEnd = newline ? newline : cuts[c+1];
+        double lineStart = omp_get_wtime();
+        line.assign(p, lineEnd);
+        int distance = lineMatches(matchRE, line);
+        double lineTime = omp_get_wtime() - lineStart;
+        myLineTimes.add(lineTime);
+        mySlowLines.add(lineTime, p - input.begin(), lineEnd - p);
+        myRes.incLines();
+        if (distance != lineMatcher::noMatch)
+          myRes.incMatchedLines(distance);
+        p = newline ? newline + 1 : lineEnd;
+      }
+      double chunkTime = omp_get_wtime() - chunkStart;
+      myChunkTimes.add(chunkTime);
+      mySlowChunks.add(chunkTime, cuts[c] - input.begin(),
+                       cuts[c+1] - cuts[c]);
+    }
+#pragma omp critical (addStats)
+    {
+      res += myRes;
+      lineTimes += myLineTimes;
+      chunkTimes += myChunkTimes;
+      slowLines += mySlowLines;
+      slowChunks += mySlowChunks;
+    }
+  }
+
+  lineTimes.print(std::cout, "Line match times");
+  chunkTimes.print(std::cout, "Chunk match times");
+  slowChunks.print(std::cout, "Slowest chunks");
+  slowLines.print(std::cout, "Slowest lines");
+  return res;
+}
+
 // Yes, this could be a std::unordered_map, but that really does seem
 // overkill for something with only a few entries which we scan once!
+enum engine_t {
+  lineEngine,   // Reads lines and uses a lineMatcher
+  dfaLines,     // Uses our DFA, only in lines mode
+  dfaMultiline, // Uses our DFA, and can match across lines
+  queryLines,   // Reads lines, and the pattern is a booleanQuery
+};
+
 static struct implementation_t {
   std::string name;
-  fileStats (*method) (std::regex const &);
+  fileStats (*method) (lineMatcher const &);
+  engine_t engine = lineEngine;
 } methods [] = {
   {"serial", runSerial},
-  {"parallel", runParallel},
-  {"parallelRed", runParallelRed},
-  {"parallelQ", runParallelQueue},
+  {"parallel", runParallel<criticalSection>},
+  {"parallelRed", runParallelRed<criticalSection>},
+  {"parallelQ", runParallelQueue<criticalSection>},
   {"task", runOmpTasks},
   {"taskTR", runOmpTasksTR},
+  {"block", runBlock, dfaMultiline},
+  {"parallelBlock", runParallelBlock, dfaLines},
+  {"speculative", runSpeculative, dfaMultiline},
+  {"topK", runTopK<criticalSection>},
+  {"dedup", runDedup, dfaLines},
+  {"profile", runProfile},
+  {"merge", runMerge},
+  {"timeSeries", runTimeSeries},
+  {"substitute", runSubstitute},
+  {"query", runQuery, queryLines},
 #if (USE_TASKREDUCTION)
   {"taskRed", runOmpTasksRed},
 #endif  
@@ -348,8 +1418,51 @@ static implementation_t * findImplementation(char const * name) {
   return 0;
 }
 
+// The strategy called name, built with Lock, or 0 if it doesn't take one.
+template <typename Lock>
+static fileStats (*lockedMethod(std::string const & name))(lineMatcher const &) {
+  if (name == "parallel")
+    return runParallel<Lock>;
+  if (name == "parallelRed")
+    return runParallelRed<Lock>;
+  if (name == "parallelQ")
+    return runParallelQueue<Lock>;
+  if (name == "topK")
+    return runTopK<Lock>;
+  return 0;
+}
+
+static struct lockImplementation_t {
+  std::string name;
+  fileStats (*(*method)(std::string const &))(lineMatcher const &);
+} locks [] = {
+  {"critical", lockedMethod<criticalSection>},
+  {"omp", lockedMethod<ompLock>},
+  {"tas", lockedMethod<tasLock>},
+  {"ttas", lockedMethod<ttasLock>},
+  {"ticket", lockedMethod<ticketLock>},
+  {"mcs", lockedMethod<mcsLock>},
+  {"clh", lockedMethod<clhLock>},
+  {"futex", lockedMethod<futexLock>},
+};
+
+static lockImplementation_t * findLock(std::string const & name) {
+  for (auto &l : locks) {
+    if (l.name == name) {
+      return &l;
+    }
+  }
+  return 0;
+}
+
 static void printHelp() {
-  std::cerr << "Need two arguments:\n"
+  std::cerr << "Usage: omp_scan [--block-size=bytes[k|M]] [--multiline] "
+    "[--dfa-cache=dir]\n                [--top=k] [--counters=m] "
+    "[--approx=k] [--chunk-cache=dir]\n"
+    "                [--placement] [--line-budget=steps] [--sample=n] "
+    "[--window=n]\n"
+    "                [--interval=seconds] [--replace=text] [--lock=name]\n"
+    "                implementation regexp [files (dedup and merge only)]\n"
     "  implementation: one of ";
   auto numMethods = sizeof(methods)/sizeof(methods[0]);
   for (int i=0; i<numMethods-1; i++) {
@@ -357,22 +1470,240 @@ static void printHelp() {
   }
   std::cerr << methods[numMethods-1].name << "\n";
   std::cerr << "  regular expression\n";
+  std::cerr << "  --block-size sets the read size for the block "
+    "implementations (default 1M)\n";
+  std::cerr << "  --multiline allows \\n in the pattern and counts matches, "
+    "which can span lines\n    (block and speculative only)\n";
+  std::cerr << "  --dfa-cache keeps compiled DFAs in dir, so that they needn't "
+    "be rebuilt\n";
+  std::cerr << "  --top=k and --counters=m set how many lines topK reports "
+    "(default 10),\n    and how many it tracks (default 1000)\n";
+  std::cerr << "  profile times each line and --block-size chunk, and reports "
+    "the --top=k\n    slowest of each\n";
+  std::cerr << "  --chunk-cache keeps dedup's results for each chunk in dir; "
+    "its chunks\n    average --block-size bytes\n";
+  std::cerr << "  --placement reports the CPUs each thread ran on, to stderr\n";
+  std::cerr << "  query takes a boolean query over patterns, such as "
+    "'/a/ AND NOT (/b/ OR /c/)',\n    and plans the order in which to test "
+    "them from --sample=n lines (default 1000)\n";
+  std::cerr << "  merge prints the matching lines from all the files in "
+    "timestamp order,\n    buffering at most --window=n (default 1000) "
+    "from each\n";
+  std::cerr << "  timeSeries counts matching lines in each --interval=seconds "
+    "(default 60)\n    from their leading timestamps\n";
+  std::cerr << "  substitute writes the input to stdout with every match "
+    "replaced by\n    --replace=text (as sed s/regexp/text/g), and its "
+    "counts to stderr\n";
+  std::cerr << "  --line-budget=steps[k|M] matches lines on which std::regex "
+    "might backtrack\n    for more steps with a linear time engine "
+    "(0 for every line). The steps are a\n    worst case estimated from the "
+    "pattern, not counted as it runs: lines longer\n    than steps^(1/degree) "
+    "bytes use the linear engine, where degree is one plus\n    the number of "
+    "variable width repeats (not counting those inside another);\n    if the "
+    "pattern may backtrack exponentially, every line does\n";
+  std::cerr << "  --lock=name uses that lock in parallel, parallelRed, "
+    "parallelQ and topK;\n    one of ";
+  auto numLocks = sizeof(locks)/sizeof(locks[0]);
+  for (size_t i=0; i<numLocks-1; i++) {
+    std::cerr << locks[i].name << ", ";
+  }
+  std::cerr << locks[numLocks-1].name << " (default critical)\n";
+  std::cerr << "  --approx=k matches the pattern as a string, allowing up to k "
+    "(<= " << fileStats::maxDistance << ") edits\n";
+}
+
+// Where are the OpenMP threads actually running? We sample each thread's
+// CPU a few times; an unbound thread may show up on several. The threads
+// persist between parallel regions, so sampling before and after the run
+// tells us about the threads which did the work.
+typedef std::vector<std::set<int>> placement_t;
+
+static void samplePlacement(placement_t & cpus) {
+  cpus.resize(omp_get_max_threads());
+#pragma omp parallel shared(cpus)
+  {
+    auto & mine = cpus[omp_get_thread_num()];
+    for (int i=0; i<10; i++) {
+      mine.insert(sched_getcpu());
+      usleep(100);
+    }
+  }
+}
+
+// Thread:cpu[,cpu...] for each thread.
+static void printPlacement(placement_t const & cpus) {
+  std::cerr << "Placement:";
+  for (size_t t=0; t<cpus.size(); t++) {
+    char const * separator = ":";
+    std::cerr << " " << t;
+    for (int cpu : cpus[t]) {
+      std::cerr << separator << cpu;
+      separator = ",";
+    }
+  }
+  std::cerr << std::endl;
+}
+
+// Tell the user if std::regex may take exponential time. If we can't parse
+// the pattern we can't tell, but std::regex may still be happy with it.
+// Only suggest --line-budget if the implementation can use it.
+static void warnIfRisky(std::string const & pattern, bool budgetable) {
+  try {
+    if (backtrackRisk(breParser(pattern, false).parse()).exponential)
+      std::cerr << "Warning: this pattern may backtrack exponentially; " <<
+        (budgetable ? "--line-budget bounds the time per line" :
+         "this implementation can't use --line-budget to avoid that") <<
+        std::endl;
+  } catch (patternError const &) {
+  }
+}
+
+// Accept a count with an optional k or M suffix.
+static bool parseSize(char const * text, size_t * value) {
+  char * end;
+  long v = strtol(text, &end, 10);
+  if (*end == 'k' || *end == 'K') {
+    v *= 1024;
+    end++;
+  } else if (*end == 'm' || *end == 'M') {
+    v *= 1024 * 1024;
+    end++;
+  }
+  if (*end || v <= 0)
+    return false;
+  *value = v;
+  return true;
 }
 
 int main (int argc, char ** argv) {
-  if (argc < 3) {
+  // Options come before the positional arguments.
+  int arg = 1;
+  for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++) {
+    if (strncmp(argv[arg], "--block-size=", 13) == 0 &&
+        parseSize(argv[arg] + 13, &options.blockSize)) {
+      continue;
+    }
+    if (strcmp(argv[arg], "--multiline") == 0) {
+      options.mode = dfaMode::multiline;
+      continue;
+    }
+    if (strncmp(argv[arg], "--dfa-cache=", 12) == 0 && argv[arg][12]) {
+      options.dfaCache = argv[arg] + 12;
+      continue;
+    }
+    if (strncmp(argv[arg], "--top=", 6) == 0 &&
+        (options.top = atoi(argv[arg] + 6)) > 0) {
+      continue;
+    }
+    if (strncmp(argv[arg], "--counters=", 11) == 0 &&
+        (options.counters = atoi(argv[arg] + 11)) > 0) {
+      continue;
+    }
+    if (strncmp(argv[arg], "--chunk-cache=", 14) == 0 && argv[arg][14]) {
+      options.chunkCache = argv[arg] + 14;
+      continue;
+    }
+    if (strcmp(argv[arg], "--placement") == 0) {
+      options.placement = true;
+      continue;
+    }
+    if (strncmp(argv[arg], "--line-budget=", 14) == 0 &&
+        (strcmp(argv[arg] + 14, "0") == 0 ||
+         parseSize(argv[arg] + 14, &options.lineBudget))) {
+      options.budgeted = true;
+      continue;
+    }
+    if (strncmp(argv[arg], "--window=", 9) == 0 &&
+        (options.window = atoi(argv[arg] + 9)) > 0) {
+      continue;
+    }
+    if (strncmp(argv[arg], "--interval=", 11) == 0 &&
+        (options.interval = atoi(argv[arg] + 11)) > 0) {
+      continue;
+    }
+    if (strncmp(argv[arg], "--replace=", 10) == 0) {
+      options.replacement = argv[arg] + 10;
+      continue;
+    }
+    if (strncmp(argv[arg], "--lock=", 7) == 0 && findLock(argv[arg] + 7)) {
+      options.lock = argv[arg] + 7;
+      continue;
+    }
+    if (strncmp(argv[arg], "--sample=", 9) == 0 &&
+        (options.sample = atoi(argv[arg] + 9)) >= 0) {
+      continue;
+    }
+    if (strncmp(argv[arg], "--approx=", 9) == 0 &&
+        (options.maxEdits = atoi(argv[arg] + 9)) >= 0 &&
+        options.maxEdits <= fileStats::maxDistance) {
+      continue;
+    }
+    std::cerr << "Unknown or invalid option " << argv[arg] << "\n";
+    printHelp();
+    return 1;
+  }
+  if (argc - arg < 2) {
     printHelp();
     return 1;
   }
 
-  auto impl = findImplementation(argv[1]);
+  auto impl = findImplementation(argv[arg]);
   if (!impl) {
     printHelp();
     return 1;
   }
+  if (!options.lock.empty()) {
+    auto method = findLock(options.lock)->method(impl->name);
+    if (!method) {
+      std::cerr << impl->name << " doesn't take a --lock\n";
+      return 1;
+    }
+    impl->method = method;
+  }
+  options.pattern = argv[arg+1];
+  options.files.assign(&argv[arg+2], &argv[argc]);
+  if (!options.files.empty() && impl->method != runDedup &&
+      impl->method != runMerge) {
+    std::cerr << "Only dedup and merge read files; the others read stdin\n";
+    return 1;
+  }
+  bool multiline = options.mode == dfaMode::multiline;
+  if (multiline && impl->engine != dfaMultiline) {
+    std::cerr << impl->name << " can't do multiline matching\n";
+    return 1;
+  }
+  bool approximate = options.maxEdits >= 0;
+  if (approximate && impl->engine != lineEngine) {
+    std::cerr << impl->name << " can't do approximate matching\n";
+    return 1;
+  }
+  if (impl->method == runSubstitute && (approximate || options.budgeted)) {
+    std::cerr << "substitute needs std::regex to find the matches, so can't "
+      "be used with --approx or --line-budget\n";
+    return 1;
+  }
 
   try {
-    std::regex matchRE (argv[2], std::regex::grep);
+    // Only build the std::regex if we're going to use it; it can be slow
+    // for big patterns, and can't handle multiline ones.
+    lineMatcher matchRE;
+    if (approximate) {
+      matchRE = lineMatcher(options.pattern, options.maxEdits);
+    } else if (impl->engine == lineEngine && options.budgeted) {
+      matchRE = makeLineMatcher(options.pattern);
+      if (matchRE.getLongestBacktracked() == 0) {
+        std::cerr << "All lines use the linear engine" << std::endl;
+      } else {
+        std::cerr << "Lines longer than " << matchRE.getLongestBacktracked()
+                  << " bytes use the linear engine" << std::endl;
+      }
+    } else if (impl->engine == lineEngine) {
+      matchRE = lineMatcher(options.pattern);
+      warnIfRisky(options.pattern, impl->method != runSubstitute);
+    }
+    placement_t placement;
+    if (options.placement)
+      samplePlacement(placement);
 #if (PRINT_TIME)
     auto start = omp_get_wtime();
     // Do the work!
@@ -383,9 +1714,24 @@ int main (int argc, char ** argv) {
     auto res = impl->method(matchRE);
 #endif
 
-    std::cout << impl->name << " (" << omp_get_max_threads() << ")" <<
+    // substitute's output is the rewritten input, so keep that clean.
+    std::ostream & summary =
+      impl->method == runSubstitute ? std::cerr : std::cout;
+    summary << impl->name << " (" << omp_get_max_threads() << ")" <<
       " Total Lines: " << res.getLines() <<
-      ", Matching Lines: " << res.getMatchedLines() << std::endl;
+      (multiline ? ", Matches: " : ", Matching Lines: ") <<
+      res.getMatchedLines() << std::endl;
+    if (options.placement) {
+      samplePlacement(placement);
+      printPlacement(placement);
+    }
+    if (approximate) {
+      std::cout << "Matching lines by edits needed:";
+      for (int d=0; d<=options.maxEdits; d++) {
+        std::cout << " " << d << ": " << res.getDistanceLines(d);
+      }
+      std::cout << std::endl;
+    }
 #if (PRINT_TIME)
     std::cerr << "Time" << std::endl <<
       impl->name << std::endl <<
@@ -396,6 +1742,13 @@ int main (int argc, char ** argv) {
     return 0;
   } catch (const std::regex_error& e) {
     std::cerr << "Invalid regular expression: " << e.what() << '\n';
+  } catch (const patternError& e) {
+    std::cerr << "Pattern not supported by the DFA or linear engine: " <<
+      e.what() << '\n';
+  } catch (const queryError& e) {
+    std::cerr << "Invalid query: " << e.what() << '\n';
+  } catch (const std::invalid_argument& e) {
+    std::cerr << e.what() << '\n';
   }
   return 1;
 }
@@ -2,6 +2,8 @@ import subprocess
 import datetime
 import platform
 import os
+import statistics
+from optparse import OptionParser
 
 hostName = platform.node().split(".")[0]
 
@@ -30,9 +32,10 @@ commands = (
 searchRe = "[aA].*[eE].*[iI].*[oO].*[uU]"
 repeats = 10
 
-def runOnce(image, arg, threads):
+def runOnce(image, arg, threads, env=""):
     command = (
-        "OMP_NUM_THREADS="
+        env
+        + "OMP_NUM_THREADS="
         + str(threads)
         + " /usr/bin/time -p "
         + image
@@ -46,6 +49,39 @@ def runOnce(image, arg, threads):
     return err.strip()
 
 
+def runFailed(err):
+    """Did time -p report that the command failed?"""
+    return (
+        "Command exited with non-zero status" in err
+        or "Command terminated by signal" in err
+    )
+
+
+def realTime(err):
+    """The real time from time -p's output, or None if the run failed"""
+    if runFailed(err):
+        return None
+    for line in err.splitlines():
+        words = line.split()
+        if len(words) == 2 and words[0] == "real":
+            return float(words[1])
+    return None
+
+
+def medianTime(samples):
+    """The median of the runs which worked, or None if none did"""
+    good = [s for s in samples if s is not None]
+    return statistics.median(good) if good else None
+
+
+def formatTime(t):
+    return "failed" if t is None else "%.3fs" % t
+
+
+def formatRatio(t, base):
+    return "-" if t is None or base is None else "%.2f" % (t / base)
+
+
 # Functions which may be useful elsewhere
 def outputName(test):
     """Generate an output file name based on the test, hostname, date, and a sequence number"""
@@ -99,4 +135,314 @@ def runAll():
         run(runs)
 
 
-runAll()
+#
+# Run the same sweep under each OpenMP runtime we can find.
+# All of these runtimes provide the GOMP_ entry points which GCC generates
+# calls to, so we can run the same g++ built binary under each of them by
+# putting a directory which contains a link with the name of the library it
+# was linked against (e.g. libgomp.so.1) on LD_LIBRARY_PATH.
+#
+runtimeLibraries = (
+    ("libgomp", ("libgomp.so.1",)),
+    ("libomp", ("libomp.so.5", "libomp.so")),
+    ("libiomp5", ("libiomp5.so",)),
+)
+
+
+def findRuntimes():
+    """Return a list of (name, library path) for each distinct installed runtime"""
+    (out, err) = capture("ldconfig -p")
+    paths = {}
+    for line in out.splitlines():
+        if "=>" in line:
+            paths[line.split()[0]] = line.split("=>")[1].strip()
+    res = []
+    seen = {}
+    for (name, sonames) in runtimeLibraries:
+        for soname in sonames:
+            if soname in paths:
+                real = os.path.realpath(paths[soname])
+                if real in seen:
+                    print("*** ", name, " is the same library as ", seen[real])
+                else:
+                    seen[real] = name
+                    res.append((name, paths[soname]))
+                break
+    return res
+
+
+def linkedRuntime(image):
+    """Which runtime library was the image linked against?"""
+    (out, err) = capture("ldd " + image)
+    for (name, sonames) in runtimeLibraries:
+        for soname in sonames:
+            if soname in out:
+                return soname
+    return None
+
+
+def runtimeEnv(name, path, soname):
+    """The environment prefix to run with this runtime in place of soname"""
+    shimDir = os.path.abspath(os.path.join("ompRuntimes", name))
+    os.makedirs(shimDir, exist_ok=True)
+    link = os.path.join(shimDir, soname)
+    if os.path.lexists(link):
+        os.remove(link)
+    os.symlink(path, link)
+    return "LD_LIBRARY_PATH=" + shimDir + " "
+
+
+# The settings which differ between runtimes and matter for how idle
+# threads behave.
+interestingSettings = (
+    "WAIT_POLICY",
+    "BLOCKTIME",
+    "SPINCOUNT",
+    "KMP_LIBRARY",
+    "OMP_DYNAMIC",
+    "_OPENMP",
+    "OMP_PROC_BIND",
+    "OMP_PLACES",
+)
+
+
+def runtimeSettings(image, env):
+    """Ask the runtime what it is doing, and pick out the interesting parts"""
+    (out, err) = capture(
+        env + "OMP_DISPLAY_ENV=verbose KMP_SETTINGS=1 " + image + " serial x < /dev/null"
+    )
+    res = []
+    for line in (out + err).splitlines():
+        line = line.strip()
+        if any(s in line for s in interestingSettings) and line not in res:
+            res.append(line)
+    return res
+
+
+def runtimeMatrix(image, args, threads, runtimes):
+    soname = linkedRuntime(image)
+    if not soname:
+        print("*** Can't tell which OpenMP runtime ", image, " uses")
+        return
+    available = findRuntimes()
+    if runtimes:
+        available = [r for r in available if r[0] in runtimes]
+    if not available:
+        message = "*** No usable OpenMP runtimes found"
+        if runtimes:
+            message += " (looked for " + ", ".join(runtimes) + ")"
+        print(message)
+        return
+    times = {}
+    settings = {}
+    for (name, path) in available:
+        env = runtimeEnv(name, path, soname)
+        settings[name] = runtimeSettings(image, env)
+        for arg in args:
+            for thread in threads:
+                samples = []
+                for i in range(repeats):
+                    print("*** ", name, " ", arg, " thread ", thread)
+                    samples.append(realTime(runOnce(image, arg, thread, env)))
+                times[(name, arg, thread)] = medianTime(samples)
+
+    names = [r[0] for r in available]
+    with open(outputName("runtimes"), "w") as f:
+        print("Runtime matrix", file=f)
+        print(image, " linked against ", soname, file=f)
+        for name in names:
+            print(name, " settings:", file=f)
+            for line in settings[name]:
+                print("    ", line, file=f)
+        print("Strategy, Threads, " + ", ".join(names) +
+              "".join(", " + n + "/" + names[0] for n in names[1:]), file=f)
+        for arg in args:
+            for thread in threads:
+                base = times[(names[0], arg, thread)]
+                row = [times[(n, arg, thread)] for n in names]
+                print(arg, ", ", thread, ", ",
+                      ", ".join(formatTime(t) for t in row),
+                      "".join(", " + formatRatio(t, base) for t in row[1:]),
+                      sep="", file=f)
+
+
+#
+# Run the sweep under each thread placement policy, checking where the
+# threads really ran (omp_scan --placement samples sched_getcpu in each
+# thread), since a policy the machine can't satisfy is quietly ignored.
+#
+placementPolicies = (
+    ("unbound", ""),
+    ("close/cores", "OMP_PROC_BIND=close OMP_PLACES=cores "),
+    ("close/threads", "OMP_PROC_BIND=close OMP_PLACES=threads "),
+    ("close/sockets", "OMP_PROC_BIND=close OMP_PLACES=sockets "),
+    ("spread/cores", "OMP_PROC_BIND=spread OMP_PLACES=cores "),
+    ("spread/threads", "OMP_PROC_BIND=spread OMP_PLACES=threads "),
+    ("spread/sockets", "OMP_PROC_BIND=spread OMP_PLACES=sockets "),
+)
+
+
+def parsePlacementRun(err):
+    """Return the real time (None if the run failed) and the set of CPUs each
+    thread ran on"""
+    real = realTime(err)
+    cpus = {}
+    for line in err.splitlines():
+        words = line.split()
+        if words and words[0] == "Placement:":
+            for entry in words[1:]:
+                (thread, where) = entry.split(":")
+                cpus[int(thread)] = set(int(c) for c in where.split(","))
+    return (real, cpus)
+
+
+def describePlacement(cpus):
+    """Summarise the observed placement: CPUs used, threads which moved and shared"""
+    used = set()
+    for c in cpus.values():
+        used |= c
+    moved = sum(1 for c in cpus.values() if len(c) > 1)
+    fixed = [min(c) for c in cpus.values() if len(c) == 1]
+    shared = len(fixed) - len(set(fixed))
+    return "%d cpus [%s] %d moved %d shared" % (
+        len(used),
+        " ".join(str(c) for c in sorted(used)),
+        moved,
+        shared,
+    )
+
+
+def affinitySweep(image, args, threads):
+    times = {}
+    observed = {}
+    for (name, env) in placementPolicies:
+        for arg in args:
+            for thread in threads:
+                samples = []
+                for i in range(repeats):
+                    print("*** ", name, " ", arg, " thread ", thread)
+                    (real, cpus) = parsePlacementRun(
+                        runOnce(image, "--placement " + arg, thread, env)
+                    )
+                    samples.append(real)
+                times[(name, arg, thread)] = medianTime(samples)
+                # The placement of the last run is representative if the
+                # threads were bound; if not it's only an example.
+                observed[(name, arg, thread)] = (
+                    describePlacement(cpus) if cpus else "unknown"
+                )
+
+    names = [p[0] for p in placementPolicies]
+    with open(outputName("affinity"), "w") as f:
+        print("Affinity sweep", file=f)
+        print("Strategy, Threads, Placement, Time, Observed", file=f)
+        for arg in args:
+            for thread in threads:
+                for name in names:
+                    print(arg, ", ", thread, ", ", name, ", ",
+                          formatTime(times[(name, arg, thread)]), ", ",
+                          observed[(name, arg, thread)], sep="", file=f)
+        print("Best placement", file=f)
+        print("Strategy, Threads, Placement, Time, Unbound/Best", file=f)
+        for arg in args:
+            for thread in threads:
+                worked = [n for n in names if times[(n, arg, thread)] is not None]
+                if not worked:
+                    print(arg, ", ", thread, ", all failed", sep="", file=f)
+                    continue
+                best = min(worked, key=lambda n: times[(n, arg, thread)])
+                bestTime = times[(best, arg, thread)]
+                print(arg, ", ", thread, ", ", best, ", ", formatTime(bestTime),
+                      ", ",
+                      formatRatio(times[("unbound", arg, thread)], bestTime),
+                      sep="", file=f)
+
+
+#
+# Run the strategy which takes a lock for every line with each of the lock
+# algorithms in locks.h (omp_scan --lock), at each thread count.
+#
+lockNames = ("critical", "omp", "tas", "ttas", "ticket", "mcs", "clh", "futex")
+
+
+def lockSweep(image, arg, threads):
+    times = {}
+    for name in lockNames:
+        for thread in threads:
+            samples = []
+            for i in range(repeats):
+                print("*** ", name, " ", arg, " thread ", thread)
+                samples.append(
+                    realTime(runOnce(image, "--lock=" + name + " " + arg, thread))
+                )
+            times[(name, thread)] = medianTime(samples)
+
+    with open(outputName("locks"), "w") as f:
+        print("Lock sweep", file=f)
+        print(arg, file=f)
+        print("Threads, " + ", ".join(lockNames) +
+              "".join(", " + n + "/" + lockNames[0] for n in lockNames[1:]),
+              file=f)
+        for thread in threads:
+            base = times[(lockNames[0], thread)]
+            row = [times[(n, thread)] for n in lockNames]
+            print(thread, ", ", ", ".join(formatTime(t) for t in row),
+                  "".join(", " + formatRatio(t, base) for t in row[1:]),
+                  sep="", file=f)
+        print("Best lock", file=f)
+        print("Threads, Lock, Time, critical/Best", file=f)
+        for thread in threads:
+            worked = [n for n in lockNames if times[(n, thread)] is not None]
+            if not worked:
+                print(thread, ", all failed", sep="", file=f)
+                continue
+            best = min(worked, key=lambda n: times[(n, thread)])
+            bestTime = times[(best, thread)]
+            print(thread, ", ", best, ", ", formatTime(bestTime), ", ",
+                  formatRatio(times[(lockNames[0], thread)], bestTime),
+                  sep="", file=f)
+
+
+options = OptionParser(
+    usage="%prog [--runtimes=all|name,name...] [--affinity] [--locks]"
+)
+options.add_option(
+    "--runtimes",
+    dest="runtimes",
+    default=None,
+    help="run the parallel sweep under each installed OpenMP runtime "
+    "(all of them, or those named: "
+    + ", ".join(r[0] for r in runtimeLibraries)
+    + ")",
+)
+options.add_option(
+    "--affinity",
+    dest="affinity",
+    action="store_true",
+    default=False,
+    help="run the parallel sweep under each OMP_PROC_BIND/OMP_PLACES policy",
+)
+options.add_option(
+    "--locks",
+    dest="locks",
+    action="store_true",
+    default=False,
+    help="run the parallel strategy with each lock algorithm",
+)
+(opts, args) = options.parse_args()
+if opts.locks:
+    (image, ops) = commands[0]
+    lockSweep(image, "parallel", ops["threads"])
+elif opts.affinity:
+    (image, ops) = commands[0]
+    affinitySweep(image, ops["args"], ops["threads"])
+elif opts.runtimes is not None:
+    (image, ops) = commands[0]
+    runtimeMatrix(
+        image,
+        ops["args"],
+        ops["threads"],
+        [r for r in opts.runtimes.split(",") if r and r != "all"],
+    )
+else:
+    runAll()
@@ -0,0 +1,156 @@
+/*
+ * The Space-Saving summary (Metwally, Agrawal and El Abbadi, "Efficient
+ * computation of frequent and top-k elements in data streams") for finding
+ * the most frequent items in a stream in fixed memory.
+ *
+ * We keep at most capacity counters. An item we're already counting has its
+ * counter incremented; a new item takes over the smallest counter (adding
+ * one to it), remembering that count as its possible overestimate. So each
+ * count is an upper bound on the item's real frequency, count - error is a
+ * lower bound, and any item which occurs more than total/capacity times is
+ * guaranteed to be present.
+ *
+ * Summaries are mergeable, so each thread can keep its own and we combine
+ * them at the end.
+ *
+ * License: Apache License v2.0 with LLVM Exceptions.
+ * See https://llvm.org/LICENSE.txt for license information.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+#ifndef MICROBM_SPACE_SAVING_H
+#define MICROBM_SPACE_SAVING_H
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class spaceSaving {
+ public:
+  struct counter {
+    std::string item;
+    long count;
+    long error; // count - error <= real frequency <= count
+  };
+
+ private:
+  size_t capacity;
+  long total;
+  // A min-heap on count, so the counter to replace is always at the front,
+  // with a map from item to its position in the heap.
+  std::vector<counter> heap;
+  std::unordered_map<std::string, size_t> position;
+
+  void swapEntries(size_t a, size_t b) {
+    std::swap(heap[a], heap[b]);
+    position[heap[a].item] = a;
+    position[heap[b].item] = b;
+  }
+  // Counts only go up, so they only need to move down the heap.
+  void siftDown(size_t i) {
+    for (;;) {
+      size_t smallest = i;
+      size_t left = 2 * i + 1;
+      size_t right = left + 1;
+      if (left < heap.size() && heap[left].count < heap[smallest].count)
+        smallest = left;
+      if (right < heap.size() && heap[right].count < heap[smallest].count)
+        smallest = right;
+      if (smallest == i)
+        return;
+      swapEntries(i, smallest);
+      i = smallest;
+    }
+  }
+  void siftUp(size_t i) {
+    while (i > 0) {
+      size_t parent = (i - 1) / 2;
+      if (heap[parent].count <= heap[i].count)
+        return;
+      swapEntries(i, parent);
+      i = parent;
+    }
+  }
+  void insert(counter c) {
+    position[c.item] = heap.size();
+    heap.push_back(std::move(c));
+    siftUp(heap.size() - 1);
+  }
+
+ public:
+  explicit spaceSaving(size_t size = 1000) : capacity(size), total(0) {}
+
+  void add(std::string const & item) {
+    total++;
+    auto it = position.find(item);
+    if (it != position.end()) {
+      size_t i = it->second;
+      heap[i].count++;
+      siftDown(i);
+    } else if (heap.size() < capacity) {
+      insert({item, 1, 0});
+    } else {
+      position.erase(heap[0].item);
+      long oldCount = heap[0].count;
+      heap[0] = {item, oldCount + 1, oldCount};
+      position[item] = 0;
+      siftDown(0);
+    }
+  }
+
+  // The largest count an item we aren't tracking could have.
+  long untrackedBound() const {
+    return heap.size() < capacity ? 0 : heap[0].count;
+  }
+  long getTotal() const { return total; }
+  size_t getCapacity() const { return capacity; }
+
+  // Merge in another summary. An item missing from one side occurred at
+  // most that side's untrackedBound times there, so we add that to both its
+  // count and its error. Then keep the capacity largest.
+  spaceSaving & operator+=(spaceSaving const & other) {
+    long myBound = untrackedBound();
+    long otherBound = other.untrackedBound();
+    std::vector<counter> merged;
+    for (auto const & c : heap) {
+      auto it = other.position.find(c.item);
+      if (it != other.position.end()) {
+        counter const & o = other.heap[it->second];
+        merged.push_back({c.item, c.count + o.count, c.error + o.error});
+      } else {
+        merged.push_back({c.item, c.count + otherBound, c.error + otherBound});
+      }
+    }
+    for (auto const & o : other.heap) {
+      if (position.find(o.item) == position.end())
+        merged.push_back({o.item, o.count + myBound, o.error + myBound});
+    }
+    if (merged.size() > capacity) {
+      std::nth_element(merged.begin(), merged.begin() + capacity, merged.end(),
+                       [](counter const & a, counter const & b) {
+                         return a.count > b.count;
+                       });
+      merged.resize(capacity);
+    }
+
+    total += other.total;
+    heap.clear();
+    position.clear();
+    for (auto & c : merged)
+      insert(std::move(c));
+    return *this;
+  }
+
+  // The k items with the highest counts, highest first.
+  std::vector<counter> top(size_t k) const {
+    std::vector<counter> res = heap;
+    std::sort(res.begin(), res.end(), [](counter const & a, counter const & b) {
+      return a.count > b.count || (a.count == b.count && a.item < b.item);
+    });
+    if (res.size() > k)
+      res.resize(k);
+    return res;
+  }
+};
+#endif
@@ -0,0 +1,127 @@
+/*
+ * Support for finding out where the time goes while scanning: a histogram
+ * of times with power of two buckets, so that a few pathological lines
+ * which take milliseconds show up next to millions which take nanoseconds,
+ * and a record of the slowest few byte ranges, so that we can go and look
+ * at them.
+ *
+ * Each thread keeps its own, and we merge them at the end.
+ *
+ * License: Apache License v2.0 with LLVM Exceptions.
+ * See https://llvm.org/LICENSE.txt for license information.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+#ifndef MICROBM_TIME_HISTOGRAM_H
+#define MICROBM_TIME_HISTOGRAM_H
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+class logHistogram {
+  // Bucket b holds times in [2^b, 2^(b+1)) ns, except that bucket 0 also
+  // holds anything shorter.
+  enum { numBuckets = 40 };
+  uint64_t counts[numBuckets];
+  uint64_t total;
+
+ public:
+  logHistogram() : total(0) { std::fill(&counts[0], &counts[numBuckets], 0); }
+
+  void add(double seconds) {
+    uint64_t ns = uint64_t(seconds * 1.e9);
+    int bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+    counts[std::min(bucket, int(numBuckets) - 1)]++;
+    total++;
+  }
+  logHistogram & operator+=(logHistogram const & other) {
+    for (int b = 0; b < numBuckets; b++)
+      counts[b] += other.counts[b];
+    total += other.total;
+    return *this;
+  }
+
+  void print(std::ostream & out, std::string const & title) const {
+    out << title << " (ns, " << total << " samples):\n";
+    uint64_t largest = *std::max_element(&counts[0], &counts[numBuckets]);
+    if (largest == 0)
+      return;
+    int first = 0, last = numBuckets - 1;
+    while (counts[first] == 0)
+      first++;
+    while (counts[last] == 0)
+      last--;
+    for (int b = first; b <= last; b++) {
+      out << "  [" << std::setw(12) << (b ? uint64_t(1) << b : 0) << ", "
+          << std::setw(12) << (uint64_t(2) << b) << ") " << std::setw(10)
+          << counts[b] << " " << std::string((50 * counts[b] + largest - 1) /
+                                             largest, '#')
+          << "\n";
+    }
+  }
+};
+
+// The slowest k byte ranges we've been shown.
+class slowestRanges {
+ public:
+  struct range {
+    double time;
+    size_t offset;
+    size_t length;
+
+    bool operator>(range const & other) const { return time > other.time; }
+  };
+
+ private:
+  size_t capacity;
+  // A min-heap on time, so the range to evict is at the front.
+  std::vector<range> heap;
+
+ public:
+  explicit slowestRanges(size_t k = 10) : capacity(k) {}
+
+  void add(double time, size_t offset, size_t length) {
+    if (heap.size() < capacity) {
+      heap.push_back({time, offset, length});
+      std::push_heap(heap.begin(), heap.end(), std::greater<range>());
+    } else if (capacity && time > heap.front().time) {
+      std::pop_heap(heap.begin(), heap.end(), std::greater<range>());
+      heap.back() = {time, offset, length};
+      std::push_heap(heap.begin(), heap.end(), std::greater<range>());
+    }
+  }
+  slowestRanges & operator+=(slowestRanges const & other) {
+    for (auto const & r : other.heap)
+      add(r.time, r.offset, r.length);
+    return *this;
+  }
+
+  // Slowest first.
+  std::vector<range> sorted() const {
+    std::vector<range> res = heap;
+    std::sort(res.begin(), res.end(), std::greater<range>());
+    return res;
+  }
+
+  void print(std::ostream & out, std::string const & title) const {
+    out << title << ":\n";
+    std::ios_base::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(1);
+    for (auto const & r : sorted()) {
+      out << "  offset " << std::setw(12) << r.offset << " length "
+          << std::setw(10) << r.length << ": " << std::setw(10)
+          << r.time * 1.e6 << " us";
+      if (r.time > 0.0)
+        out << " (" << r.length / r.time / 1.e6 << " MB/s)";
+      out << "\n";
+    }
+    out.flags(flags);
+    out.precision(precision);
+  }
+};
+#endif